@@ -0,0 +1,48 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/*
+	parameters:
+	r0 - address in - crc out
+	r1 - char count
+	r2 - crc in
+	r3 - address of 256 word lookup table (polynomial 0x04c11db7)
+*/
+
+	.text
+	.syntax unified
+	.arch armv7-m
+	.thumb
+	.thumb_func
+
+	.align	2
+
+_start:
+main:
+	cbz		r1, done
+loop:
+	ldrb	r4, [r0], #1
+	eor		r4, r4, r2, lsr #24
+	ldr		r4, [r3, r4, lsl #2]
+	eor		r2, r4, r2, lsl #8
+	subs	r1, r1, #1
+	bne		loop
+done:
+	mov		r0, r2
+	bkpt	#0
+
+	.end
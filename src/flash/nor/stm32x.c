@@ -613,129 +613,142 @@ static int stm32x_write_block(struct flash_bank *bank, uint8_t *buffer,
 {
 	struct stm32x_flash_bank *stm32x_info = bank->driver_priv;
 	struct target *target = bank->target;
-	uint32_t buffer_size = 16384;
+	uint32_t buffer_size;
 	struct working_area *source;
 	uint32_t address = bank->base + offset;
-	struct reg_param reg_params[4];
+	struct reg_param reg_params[5];
 	struct armv7m_algorithm armv7m_info;
 	int retval = ERROR_OK;
 
-	/* see contib/loaders/flash/stm32x.s for src */
+	/* see contib/loaders/flash/stm32x.S for src */
 
 	static const uint8_t stm32x_flash_write_code[] = {
-									/* #define STM32_FLASH_CR_OFFSET	0x10 */
-									/* #define STM32_FLASH_SR_OFFSET	0x0C */
-									/* write: */
-		0x08, 0x4c,					/* ldr	r4, STM32_FLASH_BASE */
-		0x1c, 0x44,					/* add	r4, r3 */
-									/* write_half_word: */
-		0x01, 0x23,					/* movs	r3, #0x01 */
-		0x23, 0x61,					/* str	r3, [r4, #STM32_FLASH_CR_OFFSET] */
-		0x30, 0xf8, 0x02, 0x3b,		/* ldrh	r3, [r0], #0x02 */
-		0x21, 0xf8, 0x02, 0x3b,		/* strh	r3, [r1], #0x02 */
+									/* wait_fifo: */
+		0x16, 0x68,					/* ldr	r6, [r2, #0] */
+		0x00, 0x2e,					/* cmp	r6, #0 */
+		0x18, 0xd0,					/* beq	exit */
+		0x55, 0x68,					/* ldr	r5, [r2, #4] */
+		0xb5, 0x42,					/* cmp	r5, r6 */
+		0xf9, 0xd0,					/* beq	wait_fifo */
+		0x2e, 0x88,					/* ldrh	r6, [r5, #0] */
+		0x26, 0x80,					/* strh	r6, [r4, #0] */
+		0x02, 0x35,					/* adds	r5, #2 */
+		0x02, 0x34,					/* adds	r4, #2 */
 									/* busy: */
-		0xe3, 0x68,					/* ldr	r3, [r4, #STM32_FLASH_SR_OFFSET] */
-		0x13, 0xf0, 0x01, 0x0f,		/* tst	r3, #0x01 */
-		0xfb, 0xd0,					/* beq	busy */
-		0x13, 0xf0, 0x14, 0x0f,		/* tst	r3, #0x14 */
-		0x01, 0xd1,					/* bne	exit */
-		0x01, 0x3a,					/* subs	r2, r2, #0x01 */
-		0xf0, 0xd1,					/* bne	write_half_word */
+		0x06, 0x68,					/* ldr	r6, [r0, #0] */
+		0x01, 0x27,					/* movs	r7, #0x01 */
+		0x3e, 0x42,					/* tst	r6, r7 */
+		0xfb, 0xd1,					/* bne	busy */
+		0x14, 0x27,					/* movs	r7, #0x14 */
+		0x3e, 0x42,					/* tst	r6, r7 */
+		0x08, 0xd1,					/* bne	error */
+		0x9d, 0x42,					/* cmp	r5, r3 */
+		0x01, 0xd3,					/* bcc	no_wrap */
+		0x15, 0x46,					/* mov	r5, r2 */
+		0x08, 0x35,					/* adds	r5, #8 */
+									/* no_wrap: */
+		0x55, 0x60,					/* str	r5, [r2, #4] */
+		0x01, 0x39,					/* subs	r1, #1 */
+		0x00, 0x29,					/* cmp	r1, #0 */
+		0x02, 0xd0,					/* beq	exit */
+		0xe5, 0xe7,					/* b	wait_fifo */
+									/* error: */
+		0x00, 0x20,					/* movs	r0, #0 */
+		0x50, 0x60,					/* str	r0, [r2, #4] */
 									/* exit: */
+		0x30, 0x46,					/* mov	r0, r6 */
 		0x00, 0xbe,					/* bkpt	#0x00 */
-		0x00, 0x20, 0x02, 0x40,		/* STM32_FLASH_BASE: .word 0x40022000 */
 	};
 
-	/* flash write code */
-	if (target_alloc_working_area(target, sizeof(stm32x_flash_write_code),
-			&stm32x_info->write_algorithm) != ERROR_OK)
+	/* flash write code, stays resident between calls */
+	retval = target_alloc_loader(target, stm32x_flash_write_code,
+			sizeof(stm32x_flash_write_code), &stm32x_info->write_algorithm);
+	if (retval == ERROR_TARGET_RESOURCE_NOT_AVAILABLE)
 	{
 		LOG_WARNING("no working area available, can't do block memory writes");
-		return ERROR_TARGET_RESOURCE_NOT_AVAILABLE;
-	};
-
-	if ((retval = target_write_buffer(target, stm32x_info->write_algorithm->address,
-			sizeof(stm32x_flash_write_code),
-			(uint8_t*)stm32x_flash_write_code)) != ERROR_OK)
+		return retval;
+	}
+	if (retval != ERROR_OK)
 		return retval;
 
-	/* memory buffer */
-	while (target_alloc_working_area_try(target, buffer_size, &source) != ERROR_OK)
+	/* memory buffer, used as a FIFO: the loader programs one end while
+	 * the host fills the other
+	 */
+	buffer_size = target_get_working_area_avail(target) & ~3;
+	if (buffer_size > 16384)
+		buffer_size = 16384;
+	if (buffer_size <= 256
+			|| target_alloc_working_area_try(target, buffer_size, &source) != ERROR_OK)
 	{
-		buffer_size /= 2;
-		if (buffer_size <= 256)
-		{
-			/* if we already allocated the writing code, but failed to get a
-			 * buffer, free the algorithm */
-			if (stm32x_info->write_algorithm)
-				target_free_working_area(target, stm32x_info->write_algorithm);
+		/* if we already allocated the writing code, but failed to get a
+		 * buffer, free the algorithm */
+		target_free_working_area(target, stm32x_info->write_algorithm);
 
-			LOG_WARNING("no large enough working area available, can't do block memory writes");
-			return ERROR_TARGET_RESOURCE_NOT_AVAILABLE;
-		}
-	};
+		LOG_WARNING("no large enough working area available, can't do block memory writes");
+		return ERROR_TARGET_RESOURCE_NOT_AVAILABLE;
+	}
+
+	/* the loader only writes the FIFO header, which is set up below */
+	source->scratch = true;
+
+	/* the loader only polls SR, programming stays enabled throughout */
+	retval = target_write_u32(target, stm32x_get_flash_reg(bank, STM32_FLASH_CR), FLASH_PG);
+	if (retval != ERROR_OK)
+		goto cleanup;
 
 	armv7m_info.common_magic = ARMV7M_COMMON_MAGIC;
 	armv7m_info.core_mode = ARMV7M_MODE_ANY;
 
-	init_reg_param(&reg_params[0], "r0", 32, PARAM_OUT);
-	init_reg_param(&reg_params[1], "r1", 32, PARAM_OUT);
-	init_reg_param(&reg_params[2], "r2", 32, PARAM_OUT);
-	init_reg_param(&reg_params[3], "r3", 32, PARAM_IN_OUT);
+	init_reg_param(&reg_params[0], "r0", 32, PARAM_IN_OUT);	/* flash status register; result out */
+	init_reg_param(&reg_params[1], "r1", 32, PARAM_OUT);	/* count (halfword-16bit) */
+	init_reg_param(&reg_params[2], "r2", 32, PARAM_OUT);	/* FIFO start */
+	init_reg_param(&reg_params[3], "r3", 32, PARAM_OUT);	/* FIFO end */
+	init_reg_param(&reg_params[4], "r4", 32, PARAM_OUT);	/* target address */
+
+	buf_set_u32(reg_params[0].value, 0, 32, stm32x_get_flash_reg(bank, STM32_FLASH_SR));
+	buf_set_u32(reg_params[1].value, 0, 32, count);
+	buf_set_u32(reg_params[2].value, 0, 32, source->address);
+	buf_set_u32(reg_params[3].value, 0, 32, source->address + source->size);
+	buf_set_u32(reg_params[4].value, 0, 32, address);
+
+	retval = target_run_flash_async_algorithm(target, buffer, count, 2,
+			0, NULL,
+			5, reg_params,
+			source->address, source->size,
+			stm32x_info->write_algorithm->address, 0,
+			&armv7m_info);
+
+	/* once the loader ran to its end, r0 holds the last status it read;
+	 * that also covers errors on blocks written after the host was done
+	 */
+	uint32_t status = buf_get_u32(reg_params[0].value, 0, 32);
 
-	while (count > 0)
+	if (retval == ERROR_TARGET_FAILURE
+			|| (retval == ERROR_OK && (status & (FLASH_PGERR | FLASH_WRPRTERR))))
 	{
-		uint32_t thisrun_count = (count > (buffer_size / 2)) ?
-				(buffer_size / 2) : count;
-
-		if ((retval = target_write_buffer(target, source->address,
-				thisrun_count * 2, buffer)) != ERROR_OK)
-			break;
-
-		buf_set_u32(reg_params[0].value, 0, 32, source->address);
-		buf_set_u32(reg_params[1].value, 0, 32, address);
-		buf_set_u32(reg_params[2].value, 0, 32, thisrun_count);
-		buf_set_u32(reg_params[3].value, 0, 32, stm32x_info->register_offset);
+		LOG_ERROR("error executing stm32x flash write algorithm");
 
-		if ((retval = target_run_algorithm(target, 0, NULL, 4, reg_params,
-				stm32x_info->write_algorithm->address,
-				0,
-				10000, &armv7m_info)) != ERROR_OK)
-		{
-			LOG_ERROR("error executing stm32x flash write algorithm");
-			break;
-		}
-
-		if (buf_get_u32(reg_params[3].value, 0, 32) & FLASH_PGERR)
-		{
+		if (status & FLASH_PGERR)
 			LOG_ERROR("flash memory not erased before writing");
-			/* Clear but report errors */
-			target_write_u32(target, STM32_FLASH_SR, FLASH_PGERR);
-			retval = ERROR_FAIL;
-			break;
-		}
-
-		if (buf_get_u32(reg_params[3].value, 0, 32) & FLASH_WRPRTERR)
-		{
+		if (status & FLASH_WRPRTERR)
 			LOG_ERROR("flash memory write protected");
-			/* Clear but report errors */
-			target_write_u32(target, STM32_FLASH_SR, FLASH_WRPRTERR);
-			retval = ERROR_FAIL;
-			break;
-		}
 
-		buffer += thisrun_count * 2;
-		address += thisrun_count * 2;
-		count -= thisrun_count;
+		/* Clear but report errors */
+		if (status & (FLASH_PGERR | FLASH_WRPRTERR))
+			target_write_u32(target, stm32x_get_flash_reg(bank, STM32_FLASH_SR),
+					status & (FLASH_PGERR | FLASH_WRPRTERR));
+		retval = ERROR_FAIL;
 	}
 
-	target_free_working_area(target, source);
-	target_free_working_area(target, stm32x_info->write_algorithm);
-
 	destroy_reg_param(&reg_params[0]);
 	destroy_reg_param(&reg_params[1]);
 	destroy_reg_param(&reg_params[2]);
 	destroy_reg_param(&reg_params[3]);
+	destroy_reg_param(&reg_params[4]);
+
+cleanup:
+	target_free_working_area(target, source);
+	target_free_working_area(target, stm32x_info->write_algorithm);
 
 	return retval;
 }
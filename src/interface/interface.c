@@ -206,3 +206,75 @@ int oocd_interface_signal_del(char *name){
 	return ERROR_OK;
 }
 
+
+
+/******************************************************************************
+ * BITSTREAM TRANSFER
+ ******************************************************************************/
+
+/** Transfer packed bitstream using given interface driver, or the one pointed
+ * by global *jtag_interface structure if NULL. Drivers implementing
+ * transfer_bits() are called directly, others get the data exploded into
+ * char-per-bit arrays for their legacy transfer() method. See struct
+ * jtag_interface for other parameters.
+ * \return number of bits transferred, or ERROR_FAIL on failure.
+ */
+int oocd_interface_transfer_bits(struct jtag_interface *interface, void *device,
+		unsigned bits, const uint8_t *mosi, uint8_t *miso, unsigned offset, int nLSBfirst){
+	char *mosidata, *misodata=NULL;
+	unsigned i, idx;
+	int retval;
+
+	if (!interface) interface=jtag_interface;
+	if (!interface){
+		LOG_ERROR("Interface does not yet exist!");
+		return ERROR_FAIL;
+	}
+	if (interface->transfer_bits)
+		return interface->transfer_bits(device, bits, mosi, miso, offset, nLSBfirst);
+	if (!interface->transfer){
+		LOG_ERROR("Interface does not support bitstream transfer!");
+		return ERROR_FAIL;
+	}
+
+	mosidata=(char *)calloc(2, bits+1);
+	if (!mosidata){
+		LOG_ERROR("cannot allocate memory for %u bits transfer", bits);
+		return ERROR_FAIL;
+	}
+	if (miso) misodata=mosidata+bits+1;
+
+	// Explode bits into char array in wire order
+	for (i=0;i<bits && mosi;i++){
+		idx=nLSBfirst?(offset+bits-1-i):(offset+i);
+		mosidata[i]=(mosi[idx/8]>>(idx%8))&1;
+	}
+
+	retval=interface->transfer(device, bits, mosidata, misodata, 0);
+
+	// Gather received bits back into packed buffer
+	for (i=0;retval>=0 && misodata && i<bits;i++){
+		idx=nLSBfirst?(offset+bits-1-i):(offset+i);
+		if (misodata[i]) miso[idx/8]|=1<<(idx%8);
+		else miso[idx/8]&=~(1<<(idx%8));
+	}
+
+	free(mosidata);
+	return retval;
+}
+
+/** Make sure everything passed to oocd_interface_transfer_bits() so far
+ * went out on the wire. Drivers may keep write-only transfers back until
+ * the next capturing one, so this has to end each sequence of operations
+ * whose outcome is reported to the caller.
+ * \return ERROR_OK on success, or an error code on failure.
+ */
+int oocd_interface_transfer_flush(struct jtag_interface *interface, void *device){
+	if (!interface) interface=jtag_interface;
+	if (!interface){
+		LOG_ERROR("Interface does not yet exist!");
+		return ERROR_FAIL;
+	}
+	if (!interface->transfer_flush) return ERROR_OK;
+	return interface->transfer_flush(device);
+}
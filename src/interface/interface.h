@@ -23,6 +23,8 @@
 #ifndef OOCD_INTERFACE_H
 #define OOCD_INTERFACE_H
 
+#include <stdint.h>
+
 /** Some generic interface signal definitions. */
 
 /// Interface Signal type declaration (single linked list element).
@@ -49,4 +51,10 @@ int oocd_interface_signal_add(char *name, unsigned int mask);
 int oocd_interface_signal_del(char *name);
 oocd_interface_signal_t *oocd_interface_signal_find(char *name);
 
+struct jtag_interface;
+
+int oocd_interface_transfer_bits(struct jtag_interface *interface, void *device,
+		unsigned bits, const uint8_t *mosi, uint8_t *miso, unsigned offset, int nLSBfirst);
+int oocd_interface_transfer_flush(struct jtag_interface *interface, void *device);
+
 #endif
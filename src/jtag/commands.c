@@ -34,14 +34,29 @@
 #include <jtag/jtag.h>
 #include "commands.h"
 
+/*
+ * Queued commands, their fields and data all come from an arena of pages.
+ * Flushing the queue only rewinds the pages, so the next queue reuses
+ * them instead of going back to malloc(); up to CMD_QUEUE_KEEP_PAGES
+ * standard pages stay around between flushes, anything beyond that (and
+ * any page sized for one oversized request) is released.
+ */
 struct cmd_queue_page {
 	void *address;
+	size_t size;
 	size_t used;
 	struct cmd_queue_page *next;
 };
 
 #define CMD_QUEUE_PAGE_SIZE (1024 * 1024)
+#define CMD_QUEUE_KEEP_PAGES 8
 static struct cmd_queue_page *cmd_queue_pages = NULL;
+/* page currently being filled; earlier pages are full */
+static struct cmd_queue_page *cmd_queue_cur_page = NULL;
+
+static struct jtag_queue_stats cmd_queue_stats;
+static unsigned cmd_queue_depth;
+static size_t cmd_queue_bytes;
 
 struct jtag_command *jtag_command_queue = NULL;
 static struct jtag_command **next_command_pointer = &jtag_command_queue;
@@ -58,12 +73,35 @@ void jtag_queue_command(struct jtag_command * cmd)
 
 	// store location where the next command pointer will be stored
 	next_command_pointer = &cmd->next;
+
+	cmd_queue_depth++;
+}
+
+static struct cmd_queue_page *cmd_queue_new_page(size_t size)
+{
+	struct cmd_queue_page *page;
+
+	page = malloc(sizeof(struct cmd_queue_page));
+	if (!page)
+		return NULL;
+
+	page->address = malloc(size);
+	if (!page->address)
+	{
+		free(page);
+		return NULL;
+	}
+	page->size = size;
+	page->used = 0;
+	page->next = NULL;
+
+	return page;
 }
 
 void* cmd_queue_alloc(size_t size)
 {
-	struct cmd_queue_page **p_page = &cmd_queue_pages;
-	int offset;
+	struct cmd_queue_page *page;
+	size_t offset;
 	uint8_t *t;
 
 	/*
@@ -98,52 +136,107 @@ void* cmd_queue_alloc(size_t size)
 	size = (size + ALIGN_SIZE -1) & (~(ALIGN_SIZE-1));
 	/* Done... */
 
-	if (*p_page)
+	page = cmd_queue_cur_page;
+	if (!page)
+	{
+		if (!cmd_queue_pages)
+			cmd_queue_pages = cmd_queue_new_page(CMD_QUEUE_PAGE_SIZE);
+		page = cmd_queue_pages;
+	}
+
+	/* move on to the next page kept from an earlier queue, or add one */
+	while (page && page->size - page->used < size)
 	{
-		while ((*p_page)->next)
-			p_page = &((*p_page)->next);
-		if (CMD_QUEUE_PAGE_SIZE - (*p_page)->used < size)
-			p_page = &((*p_page)->next);
+		if (!page->next)
+		{
+			size_t page_size = CMD_QUEUE_PAGE_SIZE;
+			if (size > page_size)
+				page_size = size;
+			page->next = cmd_queue_new_page(page_size);
+		}
+		page = page->next;
 	}
 
-	if (!*p_page)
+	if (!page)
 	{
-		*p_page = malloc(sizeof(struct cmd_queue_page));
-		(*p_page)->used = 0;
-		(*p_page)->address = malloc(CMD_QUEUE_PAGE_SIZE);
-		(*p_page)->next = NULL;
+		LOG_ERROR("out of memory for the JTAG command queue");
+		exit(-1);
 	}
+	cmd_queue_cur_page = page;
 
-	offset = (*p_page)->used;
-	(*p_page)->used += size;
+	offset = page->used;
+	page->used += size;
+	cmd_queue_bytes += size;
 
-	t = (uint8_t *)((*p_page)->address);
+	t = (uint8_t *)(page->address);
 	return t + offset;
 }
 
+/* rewind the arena, keeping the first few standard pages for reuse */
 static void cmd_queue_free(void)
 {
-	struct cmd_queue_page *page = cmd_queue_pages;
+	struct cmd_queue_page **p_page = &cmd_queue_pages;
+	unsigned pages = 0;
 
-	while (page)
+	while (*p_page)
 	{
-		struct cmd_queue_page *last = page;
+		struct cmd_queue_page *page = *p_page;
+
+		pages++;
+		if (page->size == CMD_QUEUE_PAGE_SIZE
+				&& pages <= CMD_QUEUE_KEEP_PAGES)
+		{
+			page->used = 0;
+			p_page = &page->next;
+			continue;
+		}
+
+		*p_page = page->next;
 		free(page->address);
-		page = page->next;
-		free(last);
+		free(page);
 	}
 
-	cmd_queue_pages = NULL;
+	cmd_queue_cur_page = NULL;
+
+	if (pages > cmd_queue_stats.pages_high_water)
+		cmd_queue_stats.pages_high_water = pages;
 }
 
 void jtag_command_queue_reset(void)
 {
+	if (cmd_queue_depth || cmd_queue_bytes)
+	{
+		cmd_queue_stats.flushes++;
+		cmd_queue_stats.last_depth = cmd_queue_depth;
+		cmd_queue_stats.last_bytes = cmd_queue_bytes;
+		cmd_queue_stats.total_depth += cmd_queue_depth;
+		cmd_queue_stats.total_bytes += cmd_queue_bytes;
+		if (cmd_queue_depth > cmd_queue_stats.max_depth)
+			cmd_queue_stats.max_depth = cmd_queue_depth;
+		if (cmd_queue_bytes > cmd_queue_stats.max_bytes)
+			cmd_queue_stats.max_bytes = cmd_queue_bytes;
+	}
+	cmd_queue_depth = 0;
+	cmd_queue_bytes = 0;
+
 	cmd_queue_free();
 
 	jtag_command_queue = NULL;
 	next_command_pointer = &jtag_command_queue;
 }
 
+void jtag_command_queue_stats(struct jtag_queue_stats *stats, bool reset)
+{
+	*stats = cmd_queue_stats;
+	if (reset)
+	{
+		unsigned pages_high_water = cmd_queue_stats.pages_high_water;
+
+		memset(&cmd_queue_stats, 0, sizeof(cmd_queue_stats));
+		cmd_queue_stats.pages_high_water = pages_high_water;
+	}
+}
+
 enum scan_type jtag_scan_type(const struct scan_command *cmd)
 {
 	int i;
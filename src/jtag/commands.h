@@ -169,6 +169,26 @@ void* cmd_queue_alloc(size_t size);
 void jtag_queue_command(struct jtag_command *cmd);
 void jtag_command_queue_reset(void);
 
+/// Command queue statistics, accumulated each time the queue is reset.
+struct jtag_queue_stats {
+	unsigned flushes;		///< non-empty queues executed
+	unsigned last_depth;	///< commands in the last queue
+	unsigned max_depth;
+	unsigned long long total_depth;
+	size_t last_bytes;		///< arena bytes used by the last queue
+	size_t max_bytes;
+	unsigned long long total_bytes;
+	unsigned pages_high_water;	///< most arena pages held at once
+};
+
+/**
+ * Copy out the command queue statistics.
+ * @param stats Receives the counters.
+ * @param reset If true, clear them afterwards (the page high-water
+ * mark is kept, it describes memory still held).
+ */
+void jtag_command_queue_stats(struct jtag_queue_stats *stats, bool reset);
+
 enum scan_type jtag_scan_type(const struct scan_command* cmd);
 int jtag_scan_size(const struct scan_command* cmd);
 int jtag_read_buffer(uint8_t* buffer, const struct scan_command* cmd);
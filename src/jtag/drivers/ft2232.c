@@ -155,6 +155,15 @@ enum ftdi_interface
  */
 static int ft2232_stableclocks(int num_cycles, struct jtag_command* cmd);
 
+/**
+ * Send MPSSE commands queued by write-only ft2232_transfer() calls.
+ *
+ * @param device Driver details, see struct jtag_interface transfer_flush.
+ *
+ * @returns ERROR_OK on success, or an error code on failure.
+ */
+static int ft2232_transfer_flush(void *device);
+
 static char *       ft2232_device_desc_A = NULL;
 static char*        ft2232_device_desc = NULL;
 static char*        ft2232_serial  = NULL;
@@ -671,6 +680,9 @@ int ft2232_bitbang(void *device, char *signal_name, int GETnSET, int *value){
 		return ERROR_FAIL;
 	}
 
+	// Pending transfers must reach the wire before pins change.
+	if ((retval=ft2232_transfer_flush(device)) != ERROR_OK) return retval;
+
 	if (!GETnSET){
 		// We will SET port pins selected by sigmask.
 		// Modify our pins value, but remember about other pins and their previous value
@@ -720,57 +732,293 @@ int ft2232_bitbang(void *device, char *signal_name, int GETnSET, int *value){
 }
 
 
-/** Transfer bits in/out stored in char array starting from LSB first or MSB first,
- * alternatively if you want to make MSB-first shift on LSB-first mode put data
- * in reverse order into input/output array.
+/*
+ * MPSSE opcodes used by the bitstream transfer engine below. Data is always
+ * clocked out on the falling edge and sampled on the rising edge of TCK/SWCLK,
+ * LSB first; MSB-first streams are reordered while packing.
+ */
+#define MPSSE_DO_BYTES_LSB		0x19	/* Clock Data Bytes Out, no read */
+#define MPSSE_DO_BITS_LSB		0x1b	/* Clock Data Bits Out, no read */
+#define MPSSE_DIO_BYTES_LSB		0x39	/* Clock Data Bytes In and Out */
+#define MPSSE_DIO_BITS_LSB		0x3b	/* Clock Data Bits In and Out */
+#define MPSSE_SEND_IMMEDIATE	0x87	/* Flush the chip buffer back to the host */
+#define MPSSE_BOGUS_OPCODE		0xab	/* Invalid, answered by MPSSE_BAD_COMMAND */
+#define MPSSE_BAD_COMMAND		0xfa	/* Reply to an invalid opcode, then the opcode */
+
+/*
+ * Largest chunk of bits handled by a single MPSSE command pair, chosen so
+ * that the data read back, and the two byte bad command reply closing it,
+ * always fit into the chip read queue.
+ */
+#define FT2232_TRANSFER_MAX_BITS	((FT2232_BUFFER_READ_QUEUE_SIZE - 3) * 8)
+/* Command bytes needed by ft2232_transfer_queue() for a given bit count. */
+#define FT2232_TRANSFER_CMD_SIZE(bits) \
+	((((bits) / 8) ? 3 + (bits) / 8 : 0) + (((bits) % 8) ? 3 : 0))
+#define FT2232_TRANSFER_BUFFER_SIZE \
+	(FT2232_TRANSFER_CMD_SIZE(FT2232_TRANSFER_MAX_BITS) + 8)
+
+/**
+ * MPSSE commands produced by ft2232_transfer_bits() that were not sent to the
+ * chip yet. Write-only transfers (no MISO capture requested) are kept here
+ * and go out together with the next capturing transfer, the next bitbang
+ * operation, or an explicit ft2232_transfer_flush().
+ */
+static uint8_t ft2232_transfer_buffer[FT2232_TRANSFER_BUFFER_SIZE];
+static int ft2232_transfer_buffer_size;
+
+/**
+ * Send all pending write-only transfer commands to the chip, see struct
+ * jtag_interface transfer_flush.
+ * \return ERROR_OK on success, or an error code on failure.
+ */
+static int ft2232_transfer_flush(void *device)
+{
+	uint32_t bytes_written;
+	int retval;
+
+	if (ft2232_transfer_buffer_size == 0)
+		return ERROR_OK;
+
+	retval = ft2232_write(ft2232_transfer_buffer,
+			ft2232_transfer_buffer_size, &bytes_written);
+	ft2232_transfer_buffer_size = 0;
+	if (retval != ERROR_OK)
+		LOG_ERROR("couldn't flush pending MPSSE transfer commands");
+	return retval;
+}
+
+/**
+ * Get \a count (at most 8) bits of a packed bitstream starting from wire bit
+ * \a first, returned LSB-first as they are clocked by MPSSE LSB-first
+ * commands. \a offset, \a bits and \a nLSBfirst describe the whole stream as
+ * in ft2232_transfer_bits(). NULL buffer reads as all zeros.
+ */
+static uint8_t ft2232_get_bits(const uint8_t *buf, unsigned offset, unsigned bits,
+		unsigned first, unsigned count, int nLSBfirst)
+{
+	unsigned i, idx;
+	uint8_t val = 0;
+
+	if (buf == NULL)
+		return 0;
+
+	/* fast path for byte aligned LSB-first data */
+	if (!nLSBfirst && count == 8 && ((offset + first) % 8) == 0)
+		return buf[(offset + first) / 8];
+
+	for (i = 0; i < count; i++)
+	{
+		idx = nLSBfirst ? offset + bits - 1 - first - i : offset + first + i;
+		if (buf[idx / 8] & (1 << (idx % 8)))
+			val |= 1 << i;
+	}
+	return val;
+}
+
+/**
+ * Store \a count (at most 8) bits of \a val, LSB-first wire order, into
+ * a packed bitstream starting from wire bit \a first. Bits outside the
+ * stored range are left untouched. See ft2232_get_bits().
+ */
+static void ft2232_set_bits(uint8_t *buf, unsigned offset, unsigned bits,
+		unsigned first, unsigned count, int nLSBfirst, uint8_t val)
+{
+	unsigned i, idx;
+
+	if (!nLSBfirst && count == 8 && ((offset + first) % 8) == 0)
+	{
+		buf[(offset + first) / 8] = val;
+		return;
+	}
+
+	for (i = 0; i < count; i++)
+	{
+		idx = nLSBfirst ? offset + bits - 1 - first - i : offset + first + i;
+		if (val & (1 << i))
+			buf[idx / 8] |= 1 << (idx % 8);
+		else
+			buf[idx / 8] &= ~(1 << (idx % 8));
+	}
+}
+
+/**
+ * Pack \a count wire bits of \a mosi, starting from wire bit \a first, into
+ * MPSSE byte/bit clocking commands appended to ft2232_transfer_buffer. Caller
+ * must make sure there is FT2232_TRANSFER_CMD_SIZE(count) space left.
+ * \param capture if true then MISO data is sampled and returned by the chip.
+ */
+static void ft2232_transfer_queue(const uint8_t *mosi, unsigned offset, unsigned bits,
+		unsigned first, unsigned count, int nLSBfirst, bool capture)
+{
+	uint8_t *out = ft2232_transfer_buffer + ft2232_transfer_buffer_size;
+	unsigned bytes = count / 8;
+	unsigned rest = count % 8;
+	unsigned i;
+
+	assert(count > 0 && count <= FT2232_TRANSFER_MAX_BITS);
+	assert(ft2232_transfer_buffer_size + FT2232_TRANSFER_CMD_SIZE(count)
+			<= FT2232_TRANSFER_BUFFER_SIZE);
+
+	if (bytes)
+	{
+		*out++ = capture ? MPSSE_DIO_BYTES_LSB : MPSSE_DO_BYTES_LSB;
+		*out++ = (bytes - 1) & 0xff;
+		*out++ = ((bytes - 1) >> 8) & 0xff;
+		for (i = 0; i < bytes; i++)
+			*out++ = ft2232_get_bits(mosi, offset, bits,
+					first + 8 * i, 8, nLSBfirst);
+	}
+
+	if (rest)
+	{
+		*out++ = capture ? MPSSE_DIO_BITS_LSB : MPSSE_DO_BITS_LSB;
+		*out++ = rest - 1;
+		*out++ = ft2232_get_bits(mosi, offset, bits,
+				first + 8 * bytes, rest, nLSBfirst);
+	}
+
+	ft2232_transfer_buffer_size = out - ft2232_transfer_buffer;
+}
+
+/**
+ * Send everything queued so far followed by SEND_IMMEDIATE, then read back
+ * the data captured by the last capturing command of \a count wire bits and
+ * store it into \a miso starting from wire bit \a first.
+ *
+ * A bogus opcode is sent last, so the data must be followed by its
+ * MPSSE_BAD_COMMAND reply. If the chip rejected any earlier command, its own
+ * reply shifts the data and that check fails. Captured data alone can't tell,
+ * 0xFA is a valid data byte.
+ * \return ERROR_OK on success, or an error code on failure.
+ */
+static int ft2232_transfer_run(uint8_t *miso, unsigned offset, unsigned bits,
+		unsigned first, unsigned count, int nLSBfirst)
+{
+	uint8_t buf[FT2232_BUFFER_READ_QUEUE_SIZE];
+	uint32_t bytes_read;
+	unsigned bytes = count / 8;
+	unsigned rest = count % 8;
+	unsigned size = bytes + (rest ? 1 : 0);
+	unsigned i;
+	int retval;
+
+	ft2232_transfer_buffer[ft2232_transfer_buffer_size++] = MPSSE_BOGUS_OPCODE;
+	ft2232_transfer_buffer[ft2232_transfer_buffer_size++] = MPSSE_SEND_IMMEDIATE;
+	retval = ft2232_transfer_flush(NULL);
+	if (retval != ERROR_OK)
+		return retval;
+
+	retval = ft2232_read(buf, size + 2, &bytes_read);
+	if (retval != ERROR_OK)
+	{
+		LOG_ERROR("couldn't read back %u bits of MPSSE transfer", count);
+		return retval;
+	}
+
+	if (buf[size] != MPSSE_BAD_COMMAND || buf[size + 1] != MPSSE_BOGUS_OPCODE)
+	{
+		LOG_ERROR("FTDI MPSSE 0xFA (failure) response detected!");
+		LOG_ERROR("The input buffer was:");
+		for (i = 0; i < size + 2; i++)
+			LOG_ERROR(" %x", buf[i]);
+		return ERROR_FAIL;
+	}
+
+	for (i = 0; i < bytes; i++)
+		ft2232_set_bits(miso, offset, bits, first + 8 * i, 8, nLSBfirst, buf[i]);
+
+	/* Bit mode shifts data into the chip register from its MSb side. */
+	if (rest)
+		ft2232_set_bits(miso, offset, bits, first + 8 * bytes, rest,
+				nLSBfirst, buf[bytes] >> (8 - rest));
+
+	return ERROR_OK;
+}
+
+/** Transfer packed bits in/out, see struct jtag_interface transfer_bits.
+ * Bits are packed into MPSSE byte and bit clocking commands, so each call
+ * costs at most one USB write and one USB read per FT2232_TRANSFER_MAX_BITS.
+ * When @a miso is NULL nothing is captured and the commands are only queued,
+ * to be sent together with the next capturing transfer (or bitbang operation).
+ * \param *device void pointer to pass driver details to the function.
+ * \param bits is the number of bits to transfer.
+ * \param *mosi packed data to be send, or NULL to send zeros.
+ * \param *miso packed buffer for received data, or NULL.
+ * \param offset is the bit position of the data in both buffers.
+ * \param nLSBfirst if zero shift data LSB-first, otherwise MSB-first.
+ * \return number of bits sent on success, or ERROR_FAIL on failure.
+ */
+int ft2232_transfer_bits(void *device, unsigned bits, const uint8_t *mosi,
+		uint8_t *miso, unsigned offset, int nLSBfirst)
+{
+	unsigned done, chunk;
+
+	DEBUG_JTAG_IO("ft2232_transfer_bits(bits=%u, mosi=@%p, miso=@%p, offset=%u)",
+			bits, (void*)mosi, (void*)miso, offset);
+
+	for (done = 0; done < bits; done += chunk)
+	{
+		chunk = bits - done;
+		if (chunk > FT2232_TRANSFER_MAX_BITS)
+			chunk = FT2232_TRANSFER_MAX_BITS;
+
+		/* Keep room for the command, a bogus opcode and SEND_IMMEDIATE. */
+		if (ft2232_transfer_buffer_size + FT2232_TRANSFER_CMD_SIZE(chunk) + 2
+				> FT2232_TRANSFER_BUFFER_SIZE)
+		{
+			if (ft2232_transfer_flush(device) != ERROR_OK)
+				return ERROR_FAIL;
+		}
+
+		ft2232_transfer_queue(mosi, offset, bits, done, chunk, nLSBfirst,
+				miso != NULL);
+
+		if (miso && ft2232_transfer_run(miso, offset, bits, done, chunk,
+				nLSBfirst) != ERROR_OK)
+			return ERROR_FAIL;
+	}
+
+	return bits;
+}
+
+/** Transfer bits in/out stored in char array, one element per bit.
+ * Elements are clocked on the wire in array order. This is a compatibility
+ * shim that packs the arrays and calls ft2232_transfer_bits().
  * \param *device void pointer to pass driver details to the function.
  * \param bits is the number of bits (char array elements) to transfer.
  * \param *mosidata pointer to char array with data to be send.
- * \param *misodata pointer to char array with data to be received.
- * \param nLSBfirst if zero shift data LSB-first, otherwise MSB-first.
- * \return number of bits sent on success, or ERROR_FAIL on failure. 
+ * \param *misodata pointer to char array with data to be received, or NULL.
+ * \param nLSBfirst kept for API compatibility, wire order is array order.
+ * \return number of bits sent on success, or ERROR_FAIL on failure.
  */
 int ft2232_transfer(void *device, int bits, char *mosidata, char *misodata, int nLSBfirst){
-	uint8_t buf[3];
-	int retval, bit, i;
-	uint32_t bytes_written, bytes_read;
+	uint8_t *mosi, *miso = NULL;
+	int retval, bit;
 
-	LOG_DEBUG("ft2232_transfer(device=@%p, bits=%d, mosidata=@%p, misodata=@%p, nLSDfirst=%d) ",\
-		(void*)device, bits, (void*)mosidata, (void*)misodata, nLSBfirst);
-
-	//No optimization for now, simply send one bit from one char element.
-	for (bit=0;bit<bits;bit++){
-		buf[0]=(nLSBfirst)?0x33:0x3b;	// Clock Bits In and Out LSb or MSb first.
-		buf[1]=0;					// One bit per element.
-		buf[2]=mosidata[bit]?0xff:0;	// Take data from supplied array.
-		retval=ft2232_write(buf, 3, &bytes_written);
-		if (retval<0){
-			LOG_ERROR("ft2232_write() returns %d", retval);
-			return ERROR_FAIL;
-		}
-		retval=ft2232_read((uint8_t *)&misodata[bit], 1, &bytes_read);
-		if (retval<0){
-			LOG_ERROR("ft2232_read() returns %d", retval);
-			return ERROR_FAIL;
-		}
-		// FTDI MPSSE returns shift register value, our bit is MSb 
-		misodata[bit]=(misodata[bit]&(nLSBfirst?0x01:0x80))?1:0;
-		//USE THIS FOR WIRE-LEVEL DEBUG
-		//LOG_DEBUG("read 0x%02X written 0x%02X", misodata[bit], mosidata[bit]);
-	}
-
-	/* Check if MPSSE ERROR occured and print info if so. */
-	for (bit=0;bit<bits;bit++){
-		if (misodata[bit]==(char)0xfa) {
-			LOG_ERROR("FTDI MPSSE 0xFA (failure) response detected!");
-			LOG_ERROR("The input buffer was:");
-			for (i=bit;i<bits;i++) LOG_ERROR(" %x", misodata[i]);
-			LOG_ERROR("The output buffer was:");
-			for (i=bit;i<bits;i++) LOG_ERROR(" %x", mosidata[i]);
-			return ERROR_FAIL;
-		}
+	if (bits < 0 || mosidata == NULL)
+		return ERROR_FAIL;
+
+	mosi = calloc(2, DIV_ROUND_UP(bits, 8) + 1);
+	if (mosi == NULL)
+	{
+		LOG_ERROR("couldn't allocate %d bits transfer buffer", bits);
+		return ERROR_FAIL;
 	}
-	return bit;
+	if (misodata)
+		miso = mosi + DIV_ROUND_UP(bits, 8) + 1;
+
+	for (bit = 0; bit < bits; bit++)
+		if (mosidata[bit])
+			mosi[bit / 8] |= 1 << (bit % 8);
+
+	retval = ft2232_transfer_bits(device, bits, mosi, miso, 0, 0);
+
+	if (retval >= 0 && misodata)
+		for (bit = 0; bit < bits; bit++)
+			misodata[bit] = (miso[bit / 8] >> (bit % 8)) & 1;
+
+	free(mosi);
+	return retval;
 }
 
 
@@ -3457,6 +3705,8 @@ static void flossjtag_blink(void)
 
 static int ft2232_quit(void)
 {
+	ft2232_transfer_flush(NULL);
+
 #if BUILD_FT2232_FTD2XX == 1
 	FT_STATUS status;
 
@@ -4729,6 +4979,8 @@ struct jtag_interface ft2232_interface_swd = {
 	.speed_div = ft2232_speed_div,
 	.khz = ft2232_khz,
 	.transfer = ft2232_transfer,
+	.transfer_bits = ft2232_transfer_bits,
+	.transfer_flush = ft2232_transfer_flush,
 	.bitbang = ft2232_bitbang,
 };
 
@@ -317,8 +317,33 @@ struct jtag_interface {
 	 */
 	/** current transport */
 	struct transport *transport;
-	/** Generic bitstream transfer from/into char bits array. */
+	/**
+	 * Generic bitstream transfer from/into char bits array. When @a misodata
+	 * is NULL nothing is captured and the driver may defer sending the data
+	 * until the next capturing transfer or bitbang operation.
+	 * This is kept for compatibility, new code should use @a transfer_bits.
+	 */
 	int (*transfer)(void *device, int bits, char *mosidata, char *misodata, int nLSBfirst);
+	/**
+	 * Generic bitstream transfer from/into packed bit buffers. Bits are
+	 * stored LSB-first in bytes (as in helper/binarybuffer.h) starting at
+	 * bit @a offset of both buffers, and clocked on the wire in ascending
+	 * order when @a nLSBfirst is zero, descending order otherwise. NULL
+	 * @a mosi sends zeros, NULL @a miso has the same meaning as in
+	 * @a transfer. Received bits outside of the range are left untouched.
+	 * Use oocd_interface_transfer_bits() to call it, as it falls back to
+	 * @a transfer for drivers that do not implement this method.
+	 * @returns number of bits transferred, or negative error code.
+	 */
+	int (*transfer_bits)(void *device, unsigned bits, const uint8_t *mosi,
+			uint8_t *miso, unsigned offset, int nLSBfirst);
+	/**
+	 * Send out whatever write-only transfers the driver still holds back.
+	 * Optional, drivers that never defer data need not implement it.
+	 * Use oocd_interface_transfer_flush() to call it.
+	 * @returns ERROR_OK on success, or an error code on failure.
+	 */
+	int (*transfer_flush)(void *device);
 	/** Generic signal set/get bitbang operation. */
 	int (*bitbang)(void *device, char *signal, int SETnGET, int *value);
 	/** Signals that are defined at runtime by driver initialization routine. */
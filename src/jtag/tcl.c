@@ -849,6 +849,37 @@ COMMAND_HANDLER(handle_jtag_init_command)
 	return jtag_init(CMD_CTX);
 }
 
+COMMAND_HANDLER(handle_jtag_queue_stats_command)
+{
+	struct jtag_queue_stats stats;
+	bool reset = false;
+
+	if (CMD_ARGC > 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+	if (CMD_ARGC == 1)
+	{
+		if (strcmp(CMD_ARGV[0], "reset") != 0)
+			return ERROR_COMMAND_SYNTAX_ERROR;
+		reset = true;
+	}
+
+	jtag_command_queue_stats(&stats, reset);
+
+	command_print(CMD_CTX, "%u flushes, %u arena pages at most",
+			stats.flushes, stats.pages_high_water);
+	if (stats.flushes == 0)
+		return ERROR_OK;
+
+	command_print(CMD_CTX, "commands per flush: last %u, max %u, average %llu",
+			stats.last_depth, stats.max_depth,
+			stats.total_depth / stats.flushes);
+	command_print(CMD_CTX, "bytes per flush: last %zu, max %zu, average %llu",
+			stats.last_bytes, stats.max_bytes,
+			stats.total_bytes / stats.flushes);
+
+	return ERROR_OK;
+}
+
 static const struct command_registration jtag_subcommand_handlers[] = {
 	{
 		.name = "init",
@@ -930,6 +961,15 @@ static const struct command_registration jtag_subcommand_handlers[] = {
 		.jim_handler = jim_jtag_names,
 		.help = "Returns list of all JTAG tap names.",
 	},
+	{
+		.name = "queue_stats",
+		.mode = COMMAND_EXEC,
+		.handler = handle_jtag_queue_stats_command,
+		.help = "Display how many commands and how many bytes of "
+			"queue memory each JTAG queue flush used; optionally "
+			"clear the counters.",
+		.usage = "['reset']",
+	},
 	{
 		.chain = jtag_command_handlers_to_move,
 	},
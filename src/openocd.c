@@ -340,6 +340,10 @@ static int openocd_thread(int argc, char *argv[], struct command_context *cmd_ct
 
 	server_quit();
 
+	target_quit();
+
+	transport_quit();
+
 	return ret;
 }
 
@@ -153,7 +153,7 @@ static int FreeRTOS_update_threads( struct rtos *rtos )
 	}
 
 	int thread_list_size = 0;
-	retval = target_read_buffer( rtos->target, rtos->symbols[FreeRTOS_VAL_uxCurrentNumberOfTasks].address, param->thread_count_width, (uint8_t *)&thread_list_size);
+	retval = rtos_read_buffer( rtos, rtos->symbols[FreeRTOS_VAL_uxCurrentNumberOfTasks].address, param->thread_count_width, (uint8_t *)&thread_list_size);
 
 	if ( retval != ERROR_OK )
 	{
@@ -162,35 +162,12 @@ static int FreeRTOS_update_threads( struct rtos *rtos )
 	}
 
 
-	// wipe out previous thread details if any
-	if ( rtos->thread_details != NULL )
-	{
-		int j;
-		for( j = 0; j < rtos->thread_count; j++ )
-		{
-			if ( rtos->thread_details[j].display_str != NULL )
-			{
-				free( rtos->thread_details[j].display_str );
-				rtos->thread_details[j].display_str = NULL;
-			}
-			if ( rtos->thread_details[j].thread_name_str != NULL )
-			{
-				free( rtos->thread_details[j].thread_name_str );
-				rtos->thread_details[j].thread_name_str = NULL;
-			}
-			if ( rtos->thread_details[j].extra_info_str != NULL )
-			{
-				free( rtos->thread_details[j].extra_info_str );
-				rtos->thread_details[j].extra_info_str = NULL;
-			}
-		}
-		free( rtos->thread_details );
-		rtos->thread_details = NULL;
-	}
+	// set aside previous thread details, unchanged threads reuse them
+	rtos_begin_thread_update( rtos );
 
 
 	// read the current thread
-	retval = target_read_buffer( rtos->target, rtos->symbols[FreeRTOS_VAL_pxCurrentTCB].address, param->pointer_width, (uint8_t *)&rtos->current_thread );
+	retval = rtos_read_buffer( rtos, rtos->symbols[FreeRTOS_VAL_pxCurrentTCB].address, param->pointer_width, (uint8_t *)&rtos->current_thread );
 	if ( retval != ERROR_OK )
 	{
 		LOG_OUTPUT("Error reading current thread in FreeRTOS thread list\r\n");
@@ -205,17 +182,14 @@ static int FreeRTOS_update_threads( struct rtos *rtos )
 		thread_list_size++;
 		tasks_found++;
 		rtos->thread_details = (struct thread_detail*) malloc( sizeof( struct thread_detail ) * thread_list_size );
-		rtos->thread_details->threadid = 1;
-		rtos->thread_details->exists = true;
-		rtos->thread_details->display_str = NULL;
-		rtos->thread_details->extra_info_str = NULL;
-		rtos->thread_details->thread_name_str = (char*) malloc( sizeof(tmp_str) );
-		strcpy( rtos->thread_details->thread_name_str, tmp_str );
+		rtos_update_thread( rtos, 0, 1 );
+		rtos_set_thread_str( &rtos->thread_details->thread_name_str, tmp_str );
 
 
 		if ( thread_list_size == 1 )
 		{
 			rtos->thread_count = 1;
+			rtos_end_thread_update( rtos );
 			return ERROR_OK;
 		}
 	}
@@ -254,7 +228,7 @@ static int FreeRTOS_update_threads( struct rtos *rtos )
 
 		// Read the number of threads in this list
 		int64_t list_thread_count = 0;
-		retval = target_read_buffer( rtos->target, list_of_lists[i], param->thread_count_width, (uint8_t *)&list_thread_count);
+		retval = rtos_read_buffer( rtos, list_of_lists[i], param->thread_count_width, (uint8_t *)&list_thread_count);
 		if ( retval != ERROR_OK )
 		{
 			LOG_OUTPUT("Error reading number of threads in FreeRTOS thread list\r\n");
@@ -269,7 +243,7 @@ static int FreeRTOS_update_threads( struct rtos *rtos )
 		// Read the location of first list item
 		uint64_t prev_list_elem_ptr = -1;
 		uint64_t list_elem_ptr = 0;
-		retval = target_read_buffer( rtos->target, list_of_lists[i] + param->list_next_offset, param->pointer_width, (uint8_t *)&list_elem_ptr);
+		retval = rtos_read_buffer( rtos, list_of_lists[i] + param->list_next_offset, param->pointer_width, (uint8_t *)&list_elem_ptr);
 		if ( retval != ERROR_OK )
 		{
 			LOG_OUTPUT("Error reading first thread item location in FreeRTOS thread list\r\n");
@@ -280,13 +254,15 @@ static int FreeRTOS_update_threads( struct rtos *rtos )
 		while ( (list_thread_count > 0) && ( list_elem_ptr != 0) && ( list_elem_ptr != prev_list_elem_ptr ) && ( tasks_found < thread_list_size ) )
 		{
 			// Get the location of the thread structure.
-			rtos->thread_details[tasks_found].threadid = 0;
-			retval = target_read_buffer( rtos->target, list_elem_ptr + param->list_elem_content_offset, param->pointer_width, (uint8_t *)&(rtos->thread_details[tasks_found].threadid));
+			threadid_t threadid = 0;
+			struct thread_detail *detail;
+			retval = rtos_read_buffer( rtos, list_elem_ptr + param->list_elem_content_offset, param->pointer_width, (uint8_t *)&threadid);
 			if ( retval != ERROR_OK )
 			{
 				LOG_OUTPUT("Error reading thread list item object in FreeRTOS thread list\r\n");
 				return retval;
 			}
+			detail = rtos_update_thread( rtos, tasks_found, threadid );
 
 
 			// get thread name
@@ -295,7 +271,7 @@ static int FreeRTOS_update_threads( struct rtos *rtos )
 			char tmp_str[FREERTOS_THREAD_NAME_STR_SIZE];
 
 			// Read the thread name
-			retval = target_read_buffer( rtos->target, rtos->thread_details[tasks_found].threadid + param->thread_name_offset, FREERTOS_THREAD_NAME_STR_SIZE, (uint8_t *)&tmp_str);
+			retval = rtos_read_buffer( rtos, threadid + param->thread_name_offset, FREERTOS_THREAD_NAME_STR_SIZE, (uint8_t *)&tmp_str);
 			if ( retval != ERROR_OK )
 			{
 				LOG_OUTPUT("Error reading first thread item location in FreeRTOS thread list\r\n");
@@ -308,20 +284,15 @@ static int FreeRTOS_update_threads( struct rtos *rtos )
 				strcpy(tmp_str,"No Name");
 			}
 
-			rtos->thread_details[tasks_found].thread_name_str = (char*)malloc( strlen(tmp_str)+1 );
-			strcpy( rtos->thread_details[tasks_found].thread_name_str, tmp_str );
-			rtos->thread_details[tasks_found].display_str = NULL;
-			rtos->thread_details[tasks_found].exists = true;
+			rtos_set_thread_str( &detail->thread_name_str, tmp_str );
 
-			if ( rtos->thread_details[tasks_found].threadid == rtos->current_thread )
+			if ( threadid == rtos->current_thread )
 			{
-				char running_str[] = "Running";
-				rtos->thread_details[tasks_found].extra_info_str = (char*) malloc( sizeof(running_str) );
-				strcpy( rtos->thread_details[tasks_found].extra_info_str, running_str );
+				rtos_set_thread_str( &detail->extra_info_str, "Running" );
 			}
 			else
 			{
-				rtos->thread_details[tasks_found].extra_info_str = NULL;
+				rtos_set_thread_str( &detail->extra_info_str, NULL );
 			}
 
 
@@ -330,7 +301,7 @@ static int FreeRTOS_update_threads( struct rtos *rtos )
 
 			prev_list_elem_ptr = list_elem_ptr;
 			list_elem_ptr = 0;
-			retval = target_read_buffer( rtos->target, prev_list_elem_ptr + param->list_elem_next_offset, param->pointer_width, (uint8_t *)&list_elem_ptr);
+			retval = rtos_read_buffer( rtos, prev_list_elem_ptr + param->list_elem_next_offset, param->pointer_width, (uint8_t *)&list_elem_ptr);
 			if ( retval != ERROR_OK )
 			{
 				LOG_OUTPUT("Error reading next thread item location in FreeRTOS thread list\r\n");
@@ -342,6 +313,7 @@ static int FreeRTOS_update_threads( struct rtos *rtos )
 	}
 	free( list_of_lists );
 	rtos->thread_count = tasks_found;
+	rtos_end_thread_update( rtos );
 	return 0;
 }
 
@@ -371,7 +343,7 @@ static int FreeRTOS_get_thread_reg_list(struct rtos *rtos, int64_t thread_id, ch
 	param = (const struct FreeRTOS_params*) rtos->rtos_specific_params;
 
 	// Read the stack pointer
-	retval = target_read_buffer( rtos->target, thread_id + param->thread_stack_offset, param->pointer_width, (uint8_t*)&stack_ptr);
+	retval = rtos_read_buffer( rtos, thread_id + param->thread_stack_offset, param->pointer_width, (uint8_t*)&stack_ptr);
 	if ( retval != ERROR_OK )
 	{
 		LOG_OUTPUT("Error reading stack frame from FreeRTOS thread\r\n");
@@ -430,7 +402,7 @@ static int FreeRTOS_get_thread_ascii_info( struct rtos*   rtos, threadid_t   thr
 	char tmp_str[FREERTOS_THREAD_NAME_STR_SIZE];
 
 	// Read the thread name
-	retval = target_read_buffer( rtos->target, thread_id + param->thread_name_offset, FREERTOS_THREAD_NAME_STR_SIZE, (uint8_t *)&tmp_str);
+	retval = rtos_read_buffer( rtos, thread_id + param->thread_name_offset, FREERTOS_THREAD_NAME_STR_SIZE, (uint8_t *)&tmp_str);
 	if ( retval != ERROR_OK )
 	{
 		LOG_OUTPUT("Error reading first thread item location in FreeRTOS thread list\r\n");
@@ -162,7 +162,7 @@ static int ThreadX_update_threads( struct rtos* rtos)
 
 
 	// read the number of threads
-	retval = target_read_buffer( rtos->target, rtos->symbols[ThreadX_VAL_tx_thread_created_count].address, 4, (uint8_t *)&thread_list_size);
+	retval = rtos_read_buffer( rtos, rtos->symbols[ThreadX_VAL_tx_thread_created_count].address, 4, (uint8_t *)&thread_list_size);
 
 	if ( retval != ERROR_OK )
 	{
@@ -171,35 +171,12 @@ static int ThreadX_update_threads( struct rtos* rtos)
 	}
 
 
-	// wipe out previous thread details if any
-	if ( rtos->thread_details != NULL )
-	{
-		int j;
-		for( j = 0; j < rtos->thread_count; j++ )
-		{
-			if ( rtos->thread_details[j].display_str != NULL )
-			{
-				free( rtos->thread_details[j].display_str );
-				rtos->thread_details[j].display_str = NULL;
-			}
-			if ( rtos->thread_details[j].thread_name_str != NULL )
-			{
-				free( rtos->thread_details[j].thread_name_str );
-				rtos->thread_details[j].thread_name_str = NULL;
-			}
-			if ( rtos->thread_details[j].extra_info_str != NULL )
-			{
-				free( rtos->thread_details[j].extra_info_str );
-				rtos->thread_details[j].extra_info_str = NULL;
-			}
-		}
-		free( rtos->thread_details );
-		rtos->thread_details = NULL;
-	}
+	// set aside previous thread details, unchanged threads reuse them
+	rtos_begin_thread_update( rtos );
 
 
 	// read the current thread id
-	retval = target_read_buffer( rtos->target, rtos->symbols[ThreadX_VAL_tx_thread_current_ptr].address, 4, (uint8_t *)&rtos->current_thread);
+	retval = rtos_read_buffer( rtos, rtos->symbols[ThreadX_VAL_tx_thread_current_ptr].address, 4, (uint8_t *)&rtos->current_thread);
 
 	if ( retval != ERROR_OK )
 	{
@@ -215,17 +192,14 @@ static int ThreadX_update_threads( struct rtos* rtos)
 		thread_list_size++;
 		tasks_found++;
 		rtos->thread_details = (struct thread_detail*) malloc( sizeof( struct thread_detail ) * thread_list_size );
-		rtos->thread_details->threadid = 1;
-		rtos->thread_details->exists = true;
-		rtos->thread_details->display_str = NULL;
-		rtos->thread_details->extra_info_str = NULL;
-		rtos->thread_details->thread_name_str = (char*) malloc( sizeof(tmp_str) );
-		strcpy( rtos->thread_details->thread_name_str, tmp_str );
+		rtos_update_thread( rtos, 0, 1 );
+		rtos_set_thread_str( &rtos->thread_details->thread_name_str, tmp_str );
 
 
 		if ( thread_list_size == 0 )
 		{
 			rtos->thread_count = 1;
+			rtos_end_thread_update( rtos );
 			return ERROR_OK;
 		}
 	}
@@ -239,7 +213,7 @@ static int ThreadX_update_threads( struct rtos* rtos)
 
 	// Read the pointer to the first thread
 	int64_t thread_ptr = 0;
-	retval = target_read_buffer( rtos->target, rtos->symbols[ThreadX_VAL_tx_thread_created_ptr].address, param->pointer_width, (uint8_t *)&thread_ptr);
+	retval = rtos_read_buffer( rtos, rtos->symbols[ThreadX_VAL_tx_thread_created_ptr].address, param->pointer_width, (uint8_t *)&thread_ptr);
 	if ( retval != ERROR_OK )
 	{
 		LOG_OUTPUT("Could not read ThreadX thread location from target\r\n");
@@ -255,14 +229,15 @@ static int ThreadX_update_threads( struct rtos* rtos)
 		#define THREADX_THREAD_NAME_STR_SIZE (200)
 	    char tmp_str[THREADX_THREAD_NAME_STR_SIZE];
 		unsigned int i = 0;
+		struct thread_detail *detail;
 		int64_t name_ptr = 0;
 
 		// Save the thread pointer
-		rtos->thread_details[tasks_found].threadid = thread_ptr;
+		detail = rtos_update_thread( rtos, tasks_found, thread_ptr );
 
 
 		// read the name pointer
-		retval = target_read_buffer( rtos->target, thread_ptr + param->thread_name_offset, param->pointer_width, (uint8_t *)&name_ptr);
+		retval = rtos_read_buffer( rtos, thread_ptr + param->thread_name_offset, param->pointer_width, (uint8_t *)&name_ptr);
 		if ( retval != ERROR_OK )
 		{
 			LOG_OUTPUT("Could not read ThreadX thread name pointer from target\r\n");
@@ -270,7 +245,7 @@ static int ThreadX_update_threads( struct rtos* rtos)
 		}
 
 		// Read the thread name
-		retval = target_read_buffer( rtos->target, name_ptr, THREADX_THREAD_NAME_STR_SIZE, (uint8_t *)&tmp_str);
+		retval = rtos_read_buffer( rtos, name_ptr, THREADX_THREAD_NAME_STR_SIZE, (uint8_t *)&tmp_str);
 		if ( retval != ERROR_OK )
 		{
 			LOG_OUTPUT("Error reading thread name from ThreadX target\r\n");
@@ -284,14 +259,13 @@ static int ThreadX_update_threads( struct rtos* rtos)
 		}
 
 
-		rtos->thread_details[tasks_found].thread_name_str = (char*)malloc( strlen(tmp_str)+1 );
-		strcpy( rtos->thread_details[tasks_found].thread_name_str, tmp_str );
+		rtos_set_thread_str( &detail->thread_name_str, tmp_str );
 
 
 
 		// Read the thread status
 		int64_t thread_status = 0;
-		retval = target_read_buffer( rtos->target, thread_ptr + param->thread_state_offset, 4, (uint8_t *)&thread_status);
+		retval = rtos_read_buffer( rtos, thread_ptr + param->thread_state_offset, 4, (uint8_t *)&thread_status);
 		if ( retval != ERROR_OK )
 		{
 			LOG_OUTPUT("Error reading thread state from ThreadX target\r\n");
@@ -313,12 +287,7 @@ static int ThreadX_update_threads( struct rtos* rtos)
 			state_desc = "Unknown state";
 		}
 
-		rtos->thread_details[tasks_found].extra_info_str = (char*)malloc( strlen(state_desc)+1 );
-		strcpy( rtos->thread_details[tasks_found].extra_info_str, state_desc );
-
-		rtos->thread_details[tasks_found].exists = true;
-
-		rtos->thread_details[tasks_found].display_str = NULL;
+		rtos_set_thread_str( &detail->extra_info_str, state_desc );
 
 
 
@@ -329,7 +298,7 @@ static int ThreadX_update_threads( struct rtos* rtos)
 
 		// Get the location of the next thread structure.
 		thread_ptr = 0;
-		retval = target_read_buffer( rtos->target, prev_thread_ptr + param->thread_next_offset, param->pointer_width, (uint8_t *) &thread_ptr );
+		retval = rtos_read_buffer( rtos, prev_thread_ptr + param->thread_next_offset, param->pointer_width, (uint8_t *) &thread_ptr );
 		if ( retval != ERROR_OK )
 		{
 			LOG_OUTPUT("Error reading next thread pointer in ThreadX thread list\r\n");
@@ -339,6 +308,7 @@ static int ThreadX_update_threads( struct rtos* rtos)
 	}
 
 	rtos->thread_count = tasks_found;
+	rtos_end_thread_update( rtos );
 
 	return 0;
 }
@@ -370,7 +340,7 @@ static int ThreadX_get_thread_reg_list(struct rtos *rtos, int64_t thread_id, cha
 
 	// Read the stack pointer
 	int64_t stack_ptr = 0;
-	retval = target_read_buffer( rtos->target, thread_id + param->thread_stack_offset, param->pointer_width, (uint8_t*)&stack_ptr);
+	retval = rtos_read_buffer( rtos, thread_id + param->thread_stack_offset, param->pointer_width, (uint8_t*)&stack_ptr);
 	if ( retval != ERROR_OK )
 	{
 		LOG_OUTPUT("Error reading stack frame from ThreadX thread\r\n");
@@ -454,7 +424,7 @@ static int ThreadX_get_thread_detail( struct rtos*   rtos, threadid_t   thread_i
 
 	int64_t name_ptr = 0;
 	// read the name pointer
-	retval = target_read_buffer( rtos->target, thread_id + param->thread_name_offset, param->pointer_width, (uint8_t *)&name_ptr);
+	retval = rtos_read_buffer( rtos, thread_id + param->thread_name_offset, param->pointer_width, (uint8_t *)&name_ptr);
 	if ( retval != ERROR_OK )
 	{
 		LOG_OUTPUT("Could not read ThreadX thread name pointer from target\r\n");
@@ -462,7 +432,7 @@ static int ThreadX_get_thread_detail( struct rtos*   rtos, threadid_t   thread_i
 	}
 
 	// Read the thread name
-	retval = target_read_buffer( rtos->target, name_ptr, THREADX_THREAD_NAME_STR_SIZE, (uint8_t *)&tmp_str);
+	retval = rtos_read_buffer( rtos, name_ptr, THREADX_THREAD_NAME_STR_SIZE, (uint8_t *)&tmp_str);
 	if ( retval != ERROR_OK )
 	{
 		LOG_OUTPUT("Error reading thread name from ThreadX target\r\n");
@@ -480,7 +450,7 @@ static int ThreadX_get_thread_detail( struct rtos*   rtos, threadid_t   thread_i
 
 	// Read the thread status
 	int64_t thread_status = 0;
-	retval = target_read_buffer( rtos->target, thread_id + param->thread_state_offset, 4, (uint8_t *)&thread_status);
+	retval = rtos_read_buffer( rtos, thread_id + param->thread_state_offset, 4, (uint8_t *)&thread_status);
 	if ( retval != ERROR_OK )
 	{
 		LOG_OUTPUT("Error reading thread state from ThreadX target\r\n");
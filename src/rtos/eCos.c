@@ -143,49 +143,26 @@ static int eCos_update_threads( struct rtos* rtos)
 	}
 
 
-	// wipe out previous thread details if any
-	if ( rtos->thread_details != NULL )
-	{
-		int j;
-		for( j = 0; j < rtos->thread_count; j++ )
-		{
-			if ( rtos->thread_details[j].display_str != NULL )
-			{
-				free( rtos->thread_details[j].display_str );
-				rtos->thread_details[j].display_str = NULL;
-			}
-			if ( rtos->thread_details[j].thread_name_str != NULL )
-			{
-				free( rtos->thread_details[j].thread_name_str );
-				rtos->thread_details[j].thread_name_str = NULL;
-			}
-			if ( rtos->thread_details[j].extra_info_str != NULL )
-			{
-				free( rtos->thread_details[j].extra_info_str );
-				rtos->thread_details[j].extra_info_str = NULL;
-			}
-		}
-		free( rtos->thread_details );
-		rtos->thread_details = NULL;
-	}
+	// set aside previous thread details, unchanged threads reuse them
+	rtos_begin_thread_update( rtos );
 
 
 	// determine the number of current threads
 	uint32_t thread_list_head = rtos->symbols[eCos_VAL_thread_list].address;
 	uint32_t thread_index;
-	target_read_buffer( rtos->target, thread_list_head, param->pointer_width, (uint8_t *) &thread_index );
+	rtos_read_buffer( rtos, thread_list_head, param->pointer_width, (uint8_t *) &thread_index );
 	uint32_t first_thread = thread_index;
 	do
 	{
 		thread_list_size++;
-		retval = target_read_buffer( rtos->target, thread_index + param->thread_next_offset, param->pointer_width, (uint8_t *) &thread_index );
+		retval = rtos_read_buffer( rtos, thread_index + param->thread_next_offset, param->pointer_width, (uint8_t *) &thread_index );
 	} while( thread_index!=first_thread );
 
 	// read the current thread id
 	uint32_t current_thread_addr;
-	retval = target_read_buffer( rtos->target, rtos->symbols[eCos_VAL_current_thread_ptr].address, 4, (uint8_t *)&current_thread_addr);
+	retval = rtos_read_buffer( rtos, rtos->symbols[eCos_VAL_current_thread_ptr].address, 4, (uint8_t *)&current_thread_addr);
 	rtos->current_thread = 0;
-	retval = target_read_buffer( rtos->target, current_thread_addr + param->thread_uniqueid_offset, 2, (uint8_t *)&rtos->current_thread);
+	retval = rtos_read_buffer( rtos, current_thread_addr + param->thread_uniqueid_offset, 2, (uint8_t *)&rtos->current_thread);
 	if ( retval != ERROR_OK )
 	{
 		LOG_OUTPUT("Could not read eCos current thread from target\r\n");
@@ -200,17 +177,14 @@ static int eCos_update_threads( struct rtos* rtos)
 		thread_list_size++;
 		tasks_found++;
 		rtos->thread_details = (struct thread_detail*) malloc( sizeof( struct thread_detail ) * thread_list_size );
-		rtos->thread_details->threadid = 1;
-		rtos->thread_details->exists = true;
-		rtos->thread_details->display_str = NULL;
-		rtos->thread_details->extra_info_str = NULL;
-		rtos->thread_details->thread_name_str = (char*) malloc( sizeof(tmp_str) );
-		strcpy( rtos->thread_details->thread_name_str, tmp_str );
+		rtos_update_thread( rtos, 0, 1 );
+		rtos_set_thread_str( &rtos->thread_details->thread_name_str, tmp_str );
 
 
 		if ( thread_list_size == 0 )
 		{
 			rtos->thread_count = 1;
+			rtos_end_thread_update( rtos );
 			return ERROR_OK;
 		}
 	}
@@ -228,21 +202,22 @@ static int eCos_update_threads( struct rtos* rtos)
 		#define ECOS_THREAD_NAME_STR_SIZE (200)
 		char tmp_str[ECOS_THREAD_NAME_STR_SIZE];
 		unsigned int i = 0;
+		struct thread_detail *detail;
 		uint32_t name_ptr = 0;
 		uint32_t prev_thread_ptr;
 
 		// Save the thread pointer
 		uint16_t thread_id;
-		retval = target_read_buffer( rtos->target, thread_index + param->thread_uniqueid_offset, 2, (uint8_t *)&thread_id);
+		retval = rtos_read_buffer( rtos, thread_index + param->thread_uniqueid_offset, 2, (uint8_t *)&thread_id);
 		if ( retval != ERROR_OK )
 		{
 			LOG_OUTPUT("Could not read eCos thread id from target\r\n");
 			return retval;
 		}
-		rtos->thread_details[tasks_found].threadid = thread_id;
+		detail = rtos_update_thread( rtos, tasks_found, thread_id );
 
 		// read the name pointer
-		retval = target_read_buffer( rtos->target, thread_index + param->thread_name_offset, param->pointer_width, (uint8_t *)&name_ptr);
+		retval = rtos_read_buffer( rtos, thread_index + param->thread_name_offset, param->pointer_width, (uint8_t *)&name_ptr);
 		if ( retval != ERROR_OK )
 		{
 			LOG_OUTPUT("Could not read eCos thread name pointer from target\r\n");
@@ -250,7 +225,7 @@ static int eCos_update_threads( struct rtos* rtos)
 		}
 
 		// Read the thread name
-		retval = target_read_buffer( rtos->target, name_ptr, ECOS_THREAD_NAME_STR_SIZE, (uint8_t *)&tmp_str);
+		retval = rtos_read_buffer( rtos, name_ptr, ECOS_THREAD_NAME_STR_SIZE, (uint8_t *)&tmp_str);
 		if ( retval != ERROR_OK )
 		{
 			LOG_OUTPUT("Error reading thread name from eCos target\r\n");
@@ -263,12 +238,11 @@ static int eCos_update_threads( struct rtos* rtos)
 			strcpy(tmp_str,"No Name");
 		}
 
-		rtos->thread_details[tasks_found].thread_name_str = (char*)malloc( strlen(tmp_str)+1 );
-		strcpy( rtos->thread_details[tasks_found].thread_name_str, tmp_str );
+		rtos_set_thread_str( &detail->thread_name_str, tmp_str );
 
 		// Read the thread status
 		int64_t thread_status = 0;
-		retval = target_read_buffer( rtos->target, thread_index + param->thread_state_offset, 4, (uint8_t *)&thread_status);
+		retval = rtos_read_buffer( rtos, thread_index + param->thread_state_offset, 4, (uint8_t *)&thread_status);
 		if ( retval != ERROR_OK )
 		{
 			LOG_OUTPUT("Error reading thread state from eCos target\r\n");
@@ -289,12 +263,7 @@ static int eCos_update_threads( struct rtos* rtos)
 			state_desc = "Unknown state";
 		}
 
-		rtos->thread_details[tasks_found].extra_info_str = (char*)malloc( strlen(state_desc)+1 );
-		strcpy( rtos->thread_details[tasks_found].extra_info_str, state_desc );
-
-		rtos->thread_details[tasks_found].exists = true;
-
-		rtos->thread_details[tasks_found].display_str = NULL;
+		rtos_set_thread_str( &detail->extra_info_str, state_desc );
 
 
 		tasks_found++;
@@ -302,7 +271,7 @@ static int eCos_update_threads( struct rtos* rtos)
 
 		// Get the location of the next thread structure.
 		thread_index = rtos->symbols[eCos_VAL_thread_list].address;
-		retval = target_read_buffer( rtos->target, prev_thread_ptr + param->thread_next_offset, param->pointer_width, (uint8_t *) &thread_index );
+		retval = rtos_read_buffer( rtos, prev_thread_ptr + param->thread_next_offset, param->pointer_width, (uint8_t *) &thread_index );
 		if ( retval != ERROR_OK )
 		{
 			LOG_OUTPUT("Error reading next thread pointer in eCos thread list\r\n");
@@ -312,6 +281,7 @@ static int eCos_update_threads( struct rtos* rtos)
 	while( thread_index!=first_thread );
 
 	rtos->thread_count = tasks_found;
+	rtos_end_thread_update( rtos );
 	return 0;
 }
 
@@ -345,11 +315,11 @@ static int eCos_get_thread_reg_list(struct rtos *rtos, int64_t thread_id, char *
 	uint16_t id=0;
 	uint32_t thread_list_head = rtos->symbols[eCos_VAL_thread_list].address;
 	uint32_t thread_index;
-	target_read_buffer( rtos->target, thread_list_head, param->pointer_width, (uint8_t *) &thread_index );
+	rtos_read_buffer( rtos, thread_list_head, param->pointer_width, (uint8_t *) &thread_index );
 	bool done=false;
 	while(!done)
 	{
-		retval = target_read_buffer( rtos->target, thread_index + param->thread_uniqueid_offset, 2, (uint8_t*)&id);
+		retval = rtos_read_buffer( rtos, thread_index + param->thread_uniqueid_offset, 2, (uint8_t*)&id);
 		if ( retval != ERROR_OK )
 		{
 			LOG_OUTPUT("Error reading unique id from eCos thread\r\n");
@@ -361,14 +331,14 @@ static int eCos_get_thread_reg_list(struct rtos *rtos, int64_t thread_id, char *
 			done=true;
 			break;
 		}
-		target_read_buffer( rtos->target, thread_index + param->thread_next_offset, param->pointer_width, (uint8_t *) &thread_index );
+		rtos_read_buffer( rtos, thread_index + param->thread_next_offset, param->pointer_width, (uint8_t *) &thread_index );
 	}
 
 	if(done)
 	{
 		// Read the stack pointer
 		int64_t stack_ptr = 0;
-		retval = target_read_buffer( rtos->target, thread_index + param->thread_stack_offset, param->pointer_width, (uint8_t*)&stack_ptr);
+		retval = rtos_read_buffer( rtos, thread_index + param->thread_stack_offset, param->pointer_width, (uint8_t*)&stack_ptr);
 		if ( retval != ERROR_OK )
 		{
 			LOG_OUTPUT("Error reading stack frame from eCos thread\r\n");
@@ -25,6 +25,7 @@
 
 #include "rtos.h"
 #include "target/target.h"
+#include "target/register.h"
 #include "helper/log.h"
 #include "server/gdb_server.h"
 
@@ -32,6 +33,8 @@
 static int64_t current_threadid = -1;
 
 static void hex_to_str( char* dst, char * hex_src );
+static int rtos_target_event_handler( struct target *target, enum target_event event, void *priv );
+static const char *rtos_get_thread_regs( struct rtos *rtos, threadid_t threadid );
 static int str_to_hex( char* hex_dst, char* src );
 
 
@@ -69,7 +72,14 @@ int rtos_create(Jim_GetOptInfo *goi, struct target * target)
 	}
 
 	if (target->rtos) {
+		target_unregister_event_callback( rtos_target_event_handler, target->rtos );
+		rtos_cache_invalidate( target->rtos );
+		// drop the thread list
+		rtos_begin_thread_update( target->rtos );
+		rtos_end_thread_update( target->rtos );
 		free((void *)(target->rtos));
+		// memory writes check it, don't leave it dangling on errors below
+		target->rtos = NULL;
 	}
 //			e = Jim_GetOpt_String(goi, &cp, NULL);
 //			target->rtos = strdup(cp);
@@ -116,6 +126,7 @@ int rtos_create(Jim_GetOptInfo *goi, struct target * target)
 	target->rtos->current_thread = 0;
 	target->rtos->symbols = NULL;
 	target->rtos->target = target;
+	target_register_event_callback( rtos_target_event_handler, target->rtos );
 
 	if ( 0 != strcmp( cp, "auto") )
 	{
@@ -508,19 +519,64 @@ int rtos_get_gdb_reg_list(struct connection *connection, struct target *target,
 		 ( current_threadid != 0 ) &&
 		 ( current_threadid != target->rtos->current_thread ) )
 	{
-		char * hex_reg_list;
-		target->rtos->type->get_thread_reg_list( target->rtos, current_threadid, &hex_reg_list );
+		const char * hex_reg_list = rtos_get_thread_regs( target->rtos, current_threadid );
 
 		if ( hex_reg_list != NULL )
 		{
-			gdb_put_packet(connection, hex_reg_list, strlen(hex_reg_list));
-			free(hex_reg_list);
+			gdb_put_packet(connection, (char*)hex_reg_list, strlen(hex_reg_list));
 			return ERROR_OK;
 		}
 	}
 	return ERROR_FAIL;
 }
 
+int rtos_get_gdb_reg(struct connection *connection, struct target *target, int reg_num)
+{
+	if ( ( target->rtos != NULL ) &&
+		 ( current_threadid != -1 ) &&
+		 ( current_threadid != 0 ) &&
+		 ( current_threadid != target->rtos->current_thread ) )
+	{
+		const char * hex_reg_list = rtos_get_thread_regs( target->rtos, current_threadid );
+		struct reg **reg_list;
+		int reg_list_size;
+		size_t offset = 0;
+		size_t len;
+		int i;
+
+		if ( hex_reg_list == NULL )
+		{
+			return ERROR_FAIL;
+		}
+
+		// the list is laid out like the one of a 'g' packet
+		if ( target_get_gdb_reg_list( target, &reg_list, &reg_list_size ) != ERROR_OK )
+		{
+			return ERROR_FAIL;
+		}
+		if ( ( reg_num < 0 ) || ( reg_num >= reg_list_size ) )
+		{
+			free( reg_list );
+			return ERROR_FAIL;
+		}
+		for( i = 0; i < reg_num; i++ )
+		{
+			offset += DIV_ROUND_UP( reg_list[i]->size, 8 ) * 2;
+		}
+		len = DIV_ROUND_UP( reg_list[reg_num]->size, 8 ) * 2;
+		free( reg_list );
+
+		if ( offset + len > strlen( hex_reg_list ) )
+		{
+			return ERROR_FAIL;
+		}
+
+		gdb_put_packet(connection, (char*)hex_reg_list + offset, len);
+		return ERROR_OK;
+	}
+	return ERROR_FAIL;
+}
+
 
 
 int rtos_generic_stack_read( struct target * target, const struct rtos_register_stacking* stacking, int64_t stack_ptr, char ** hex_reg_list )
@@ -544,7 +600,7 @@ int rtos_generic_stack_read( struct target * target, const struct rtos_register_
 	{
 		address -=  stacking->stack_registers_size;
 	}
-	retval = target_read_buffer( target, address, stacking->stack_registers_size, stack_data);
+	retval = rtos_read_buffer( target->rtos, address, stacking->stack_registers_size, stack_data);
 	if ( retval != ERROR_OK )
 	{
 		LOG_OUTPUT("Error reading stack frame from FreeRTOS thread\r\n");
@@ -662,7 +718,299 @@ int rtos_update_threads( struct target* target )
 {
 	if ((target->rtos != NULL) && (target->rtos->type != NULL))
 	{
+		rtos_cache_invalidate(target->rtos);
 		target->rtos->type->update_threads(target->rtos);
 	}
 	return ERROR_OK;
 }
+
+
+/* Target memory read by the RTOS support is cached until the target
+ * runs again or its memory is written.  Misses are read in whole
+ * RTOS_CACHE_LINE sized chunks and merged with neighbouring blocks, so
+ * walking the fields of a TCB costs one read instead of one per field.
+ */
+#define RTOS_CACHE_LINE	(256)
+
+void rtos_cache_invalidate( struct rtos *rtos )
+{
+	int i;
+
+	for( i = 0; i < rtos->mem_cache_count; i++ )
+	{
+		free( rtos->mem_cache[i].data );
+	}
+	free( rtos->mem_cache );
+	rtos->mem_cache = NULL;
+	rtos->mem_cache_count = 0;
+
+	for( i = 0; i < rtos->reg_cache_count; i++ )
+	{
+		free( rtos->reg_cache[i].hex_reg_list );
+	}
+	free( rtos->reg_cache );
+	rtos->reg_cache = NULL;
+	rtos->reg_cache_count = 0;
+}
+
+/* gdb asks for the registers of each thread many times over while the
+ * target stays halted ('g', then 'p' for single registers, for every
+ * frame of a backtrace), so keep what the backend worked out.
+ */
+static const char *rtos_get_thread_regs( struct rtos *rtos, threadid_t threadid )
+{
+	struct rtos_thread_regs *regs;
+	char * hex_reg_list = NULL;
+	int i;
+
+	for( i = 0; i < rtos->reg_cache_count; i++ )
+	{
+		if ( rtos->reg_cache[i].threadid == threadid )
+		{
+			return rtos->reg_cache[i].hex_reg_list;
+		}
+	}
+
+	rtos->type->get_thread_reg_list( rtos, threadid, &hex_reg_list );
+	if ( hex_reg_list == NULL )
+	{
+		return NULL;
+	}
+
+	regs = (struct rtos_thread_regs*) realloc( rtos->reg_cache, sizeof( struct rtos_thread_regs ) * ( rtos->reg_cache_count + 1 ) );
+	if ( regs == NULL )
+	{
+		free( hex_reg_list );
+		return NULL;
+	}
+	rtos->reg_cache = regs;
+	regs[rtos->reg_cache_count].threadid = threadid;
+	regs[rtos->reg_cache_count].hex_reg_list = hex_reg_list;
+	rtos->reg_cache_count++;
+
+	return hex_reg_list;
+}
+
+static int rtos_cache_fill( struct rtos *rtos, uint32_t address, uint32_t size )
+{
+	uint32_t start = address & ~(RTOS_CACHE_LINE - 1);
+	uint64_t end = ((uint64_t)address + size + RTOS_CACHE_LINE - 1) & ~(uint64_t)(RTOS_CACHE_LINE - 1);
+	struct rtos_mem_block merged;
+	uint64_t pos;
+	int first, last;
+	int i;
+	int retval;
+
+	if ( end > 0x100000000ull )
+	{
+		end = 0x100000000ull;
+	}
+
+	// blocks overlapping or touching [start, end) become part of the new one
+	for( first = 0; first < rtos->mem_cache_count; first++ )
+	{
+		if ( (uint64_t)rtos->mem_cache[first].address + rtos->mem_cache[first].size >= start )
+		{
+			break;
+		}
+	}
+	for( last = first; last < rtos->mem_cache_count; last++ )
+	{
+		if ( rtos->mem_cache[last].address > end )
+		{
+			break;
+		}
+	}
+
+	if ( ( first < last ) && ( rtos->mem_cache[first].address < start ) )
+	{
+		start = rtos->mem_cache[first].address;
+	}
+	if ( ( first < last ) && ( (uint64_t)rtos->mem_cache[last-1].address + rtos->mem_cache[last-1].size > end ) )
+	{
+		end = (uint64_t)rtos->mem_cache[last-1].address + rtos->mem_cache[last-1].size;
+	}
+
+	merged.address = start;
+	merged.size = end - start;
+	merged.data = (uint8_t*) malloc( merged.size );
+	if ( merged.data == NULL )
+	{
+		return ERROR_FAIL;
+	}
+
+	// read the gaps, reuse what is already there
+	pos = start;
+	for( i = first; i <= last; i++ )
+	{
+		uint64_t gap_end = ( i < last ) ? rtos->mem_cache[i].address : end;
+
+		if ( gap_end > pos )
+		{
+			retval = target_read_buffer( rtos->target, pos, gap_end - pos, merged.data + (pos - start) );
+			if ( retval != ERROR_OK )
+			{
+				free( merged.data );
+				return retval;
+			}
+		}
+		if ( i < last )
+		{
+			memcpy( merged.data + (rtos->mem_cache[i].address - start), rtos->mem_cache[i].data, rtos->mem_cache[i].size );
+			pos = (uint64_t)rtos->mem_cache[i].address + rtos->mem_cache[i].size;
+		}
+	}
+
+	for( i = first; i < last; i++ )
+	{
+		free( rtos->mem_cache[i].data );
+	}
+
+	if ( first == last )
+	{
+		struct rtos_mem_block *blocks = (struct rtos_mem_block*) realloc( rtos->mem_cache,
+				sizeof( struct rtos_mem_block ) * ( rtos->mem_cache_count + 1 ) );
+		if ( blocks == NULL )
+		{
+			free( merged.data );
+			return ERROR_FAIL;
+		}
+		rtos->mem_cache = blocks;
+		memmove( &blocks[first + 1], &blocks[first], sizeof( struct rtos_mem_block ) * ( rtos->mem_cache_count - first ) );
+		rtos->mem_cache_count++;
+	}
+	else
+	{
+		memmove( &rtos->mem_cache[first + 1], &rtos->mem_cache[last], sizeof( struct rtos_mem_block ) * ( rtos->mem_cache_count - last ) );
+		rtos->mem_cache_count -= last - first - 1;
+	}
+	rtos->mem_cache[first] = merged;
+
+	return ERROR_OK;
+}
+
+int rtos_read_buffer( struct rtos *rtos, uint32_t address, uint32_t size, uint8_t *buffer )
+{
+	int attempt;
+	int i;
+
+	for( attempt = 0; ( attempt < 2 ) && ( (uint64_t)address + size <= 0x100000000ull ); attempt++ )
+	{
+		for( i = 0; i < rtos->mem_cache_count; i++ )
+		{
+			struct rtos_mem_block *block = &rtos->mem_cache[i];
+
+			if ( ( address >= block->address ) &&
+				 ( (uint64_t)address + size <= (uint64_t)block->address + block->size ) )
+			{
+				memcpy( buffer, block->data + (address - block->address), size );
+				return ERROR_OK;
+			}
+		}
+
+		if ( ( attempt == 0 ) && ( rtos_cache_fill( rtos, address, size ) != ERROR_OK ) )
+		{
+			break;
+		}
+	}
+
+	// the surrounding lines may not be readable, try just what was asked for
+	return target_read_buffer( rtos->target, address, size, buffer );
+}
+
+static int rtos_target_event_handler( struct target *target, enum target_event event, void *priv )
+{
+	struct rtos *rtos = priv;
+
+	// halts, resumes and resets all leave the cached memory stale
+	if ( rtos->target == target )
+	{
+		rtos_cache_invalidate( rtos );
+	}
+	return ERROR_OK;
+}
+
+
+/* Backends rebuild the thread list on every halt.  Most threads are the
+ * same as last time, so their strings are carried over instead of being
+ * freed and allocated again.
+ */
+void rtos_begin_thread_update( struct rtos *rtos )
+{
+	rtos_end_thread_update( rtos );
+
+	rtos->prev_thread_details = rtos->thread_details;
+	rtos->prev_thread_count = rtos->thread_count;
+	rtos->thread_details = NULL;
+	rtos->thread_count = 0;
+}
+
+struct thread_detail *rtos_update_thread( struct rtos *rtos, int index, threadid_t threadid )
+{
+	struct thread_detail *detail = &rtos->thread_details[index];
+	struct thread_detail *prev = NULL;
+	int i;
+
+	// the list is usually walked in the same order as last time
+	if ( ( index < rtos->prev_thread_count ) && ( rtos->prev_thread_details[index].threadid == threadid ) )
+	{
+		prev = &rtos->prev_thread_details[index];
+	}
+	for( i = 0; ( prev == NULL ) && ( i < rtos->prev_thread_count ); i++ )
+	{
+		if ( rtos->prev_thread_details[i].threadid == threadid )
+		{
+			prev = &rtos->prev_thread_details[i];
+		}
+	}
+
+	detail->threadid = threadid;
+	detail->exists = true;
+	detail->display_str = NULL;
+	detail->thread_name_str = NULL;
+	detail->extra_info_str = NULL;
+
+	if ( prev != NULL )
+	{
+		detail->display_str = prev->display_str;
+		detail->thread_name_str = prev->thread_name_str;
+		detail->extra_info_str = prev->extra_info_str;
+		prev->display_str = NULL;
+		prev->thread_name_str = NULL;
+		prev->extra_info_str = NULL;
+		// a thread id can only show up once
+		prev->threadid = 0;
+	}
+
+	if ( rtos->thread_count <= index )
+	{
+		rtos->thread_count = index + 1;
+	}
+	return detail;
+}
+
+void rtos_set_thread_str( char **str, const char *value )
+{
+	if ( ( *str != NULL ) && ( value != NULL ) && ( 0 == strcmp( *str, value ) ) )
+	{
+		return;
+	}
+
+	free( *str );
+	*str = ( value != NULL ) ? strdup( value ) : NULL;
+}
+
+void rtos_end_thread_update( struct rtos *rtos )
+{
+	int j;
+
+	for( j = 0; j < rtos->prev_thread_count; j++ )
+	{
+		free( rtos->prev_thread_details[j].display_str );
+		free( rtos->prev_thread_details[j].thread_name_str );
+		free( rtos->prev_thread_details[j].extra_info_str );
+	}
+	free( rtos->prev_thread_details );
+	rtos->prev_thread_details = NULL;
+	rtos->prev_thread_count = 0;
+}
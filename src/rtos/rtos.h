@@ -50,6 +50,20 @@ struct thread_detail
 	char * extra_info_str;
 };
 
+/* A chunk of target memory read while the target is halted */
+struct rtos_mem_block
+{
+	uint32_t address;
+	uint32_t size;
+	uint8_t *data;
+};
+
+struct rtos_thread_regs
+{
+	threadid_t threadid;
+	char *hex_reg_list;
+};
+
 struct rtos
 {
 	const struct rtos_type *type;
@@ -64,6 +78,17 @@ struct rtos
 
 	void * rtos_specific_params;
 
+	/* sorted, non-adjacent blocks; see rtos_read_buffer() */
+	struct rtos_mem_block *mem_cache;
+	int mem_cache_count;
+
+	/* register lists of other threads as sent to gdb, cached with memory */
+	struct rtos_thread_regs *reg_cache;
+	int reg_cache_count;
+
+	/* thread list of the previous update, see rtos_begin_thread_update() */
+	struct thread_detail* prev_thread_details;
+	int prev_thread_count;
 };
 
 
@@ -101,6 +126,15 @@ int rtos_generic_stack_read( struct target * target, const struct rtos_register_
 int rtos_try_next( struct target * target );
 int gdb_thread_packet(struct connection *connection, struct target *target, char *packet, int packet_size);
 int rtos_get_gdb_reg_list(struct connection *connection, struct target *target, struct reg **reg_list[], int *reg_list_size);
+int rtos_get_gdb_reg(struct connection *connection, struct target *target, int reg_num);
 int rtos_update_threads( struct target *target );
 
+int rtos_read_buffer( struct rtos *rtos, uint32_t address, uint32_t size, uint8_t *buffer );
+void rtos_cache_invalidate( struct rtos *rtos );
+
+void rtos_begin_thread_update( struct rtos *rtos );
+struct thread_detail *rtos_update_thread( struct rtos *rtos, int index, threadid_t threadid );
+void rtos_set_thread_str( char **str, const char *value );
+void rtos_end_thread_update( struct rtos *rtos );
+
 #endif // RTOS_H
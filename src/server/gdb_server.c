@@ -75,8 +75,24 @@ struct gdb_connection
 	 * (ca. 10% or so...).
 	 */
 	bool mem_write_error;
+	/* Contiguous X packet payloads are collected here and written to the
+	 * target in one go at the next sync point, see gdb_write_behind_flush().
+	 */
+	uint8_t *write_behind;
+	uint32_t write_behind_address;
+	uint32_t write_behind_count;
+	bool write_behind_timer;
+	struct connection *write_behind_next;
 };
 
+/* Largest run of X packet data held back before it is written out */
+#define GDB_WRITE_BEHIND_SIZE	(256 * 1024)
+/* Idle time after which held back X packet data is written anyway */
+#define GDB_WRITE_BEHIND_MS	50
+
+/* connections holding back X packet data, see gdb_write_behind_sync() */
+static struct connection *gdb_write_behind_pending;
+
 
 #if 0
 #define _DEBUG_GDB_IO_
@@ -88,6 +104,8 @@ static int gdb_breakpoint_override;
 static enum breakpoint_type gdb_breakpoint_override_type;
 
 static int gdb_error(struct connection *connection, int retval);
+static int gdb_write_behind_flush(struct connection *connection);
+static int gdb_write_behind_timeout(void *priv);
 static const char *gdb_port;
 static const char *gdb_port_next;
 static const char DIGITS[16] = "0123456789abcdef";
@@ -190,6 +208,10 @@ static int gdb_get_char_inner(struct connection *connection, int* next_char)
 		}
 		else
 		{
+			/* gdb won't answer what it hasn't received yet */
+			retval = connection_flush(connection);
+			if (retval != ERROR_OK)
+				return retval;
 			retval = check_pending(connection, 1, NULL);
 			if (retval != ERROR_OK)
 				return retval;
@@ -344,6 +366,66 @@ static int gdb_write(struct connection *connection, void *data, int len)
 	return ERROR_SERVER_REMOTE_CLOSED;
 }
 
+/* Wait for GDB to acknowledge the packet just sent. *resend is set
+ * when GDB asked for the packet to be sent again. */
+static int gdb_get_packet_ack(struct connection *connection, bool *resend)
+{
+	struct gdb_connection *gdb_con = connection->priv;
+	int reply;
+	int retval;
+
+	*resend = false;
+
+	if ((retval = gdb_get_char(connection, &reply)) != ERROR_OK)
+		return retval;
+
+	if (reply == '+')
+		return ERROR_OK;
+	else if (reply == '-')
+	{
+		/* Stop sending output packets for now */
+		log_remove_callback(gdb_log_callback, connection);
+		LOG_WARNING("negative reply, retrying");
+		*resend = true;
+	}
+	else if (reply == 0x3)
+	{
+		gdb_con->ctrl_c = 1;
+		if ((retval = gdb_get_char(connection, &reply)) != ERROR_OK)
+			return retval;
+		if (reply == '+')
+			return ERROR_OK;
+		else if (reply == '-')
+		{
+			/* Stop sending output packets for now */
+			log_remove_callback(gdb_log_callback, connection);
+			LOG_WARNING("negative reply, retrying");
+			*resend = true;
+		}
+		else if (reply == '$') {
+			LOG_ERROR("GDB missing ack(1) - assumed good");
+			gdb_putback_char(connection, reply);
+		} else {
+
+			LOG_ERROR("unknown character(1) 0x%2.2x in reply, dropping connection", reply);
+			gdb_con->closed = 1;
+			return ERROR_SERVER_REMOTE_CLOSED;
+		}
+	}
+	else if (reply == '$') {
+		LOG_ERROR("GDB missing ack(2) - assumed good");
+		gdb_putback_char(connection, reply);
+	}
+	else
+	{
+		LOG_ERROR("unknown character(2) 0x%2.2x in reply, dropping connection", reply);
+		gdb_con->closed = 1;
+		return ERROR_SERVER_REMOTE_CLOSED;
+	}
+
+	return ERROR_OK;
+}
+
 static int gdb_put_packet_inner(struct connection *connection,
 		char *buffer, int len)
 {
@@ -351,8 +433,8 @@ static int gdb_put_packet_inner(struct connection *connection,
 	unsigned char my_checksum = 0;
 #ifdef _DEBUG_GDB_IO_
 	char *debug_buffer;
-#endif
 	int reply;
+#endif
 	int retval;
 	struct gdb_connection *gdb_con = connection->priv;
 
@@ -434,52 +516,42 @@ static int gdb_put_packet_inner(struct connection *connection,
 		if (gdb_con->noack_mode)
 			break;
 
-		if ((retval = gdb_get_char(connection, &reply)) != ERROR_OK)
+		bool resend;
+		if ((retval = gdb_get_packet_ack(connection, &resend)) != ERROR_OK)
 			return retval;
+		if (!resend)
+			break;
+	}
+	if (gdb_con->closed)
+		return ERROR_SERVER_REMOTE_CLOSED;
 
-		if (reply == '+')
+	return ERROR_OK;
+}
+
+/* Send a packet that the caller has already framed as "$...#cc", in a
+ * single write, e.g. memory replies encoded by gdb_frame_memory(). */
+static int gdb_put_frame_inner(struct connection *connection,
+		char *frame, int frame_len)
+{
+	int retval;
+	struct gdb_connection *gdb_con = connection->priv;
+
+	while (1)
+	{
+#ifdef _DEBUG_GDB_IO_
+		LOG_DEBUG("sending %d byte packet '%c...'", frame_len, frame[1]);
+#endif
+		if ((retval = gdb_write(connection, frame, frame_len)) != ERROR_OK)
+			return retval;
+
+		if (gdb_con->noack_mode)
 			break;
-		else if (reply == '-')
-		{
-			/* Stop sending output packets for now */
-			log_remove_callback(gdb_log_callback, connection);
-			LOG_WARNING("negative reply, retrying");
-		}
-		else if (reply == 0x3)
-		{
-			gdb_con->ctrl_c = 1;
-			if ((retval = gdb_get_char(connection, &reply)) != ERROR_OK)
-				return retval;
-			if (reply == '+')
-				break;
-			else if (reply == '-')
-			{
-				/* Stop sending output packets for now */
-				log_remove_callback(gdb_log_callback, connection);
-				LOG_WARNING("negative reply, retrying");
-			}
-			else if (reply == '$') {
-				LOG_ERROR("GDB missing ack(1) - assumed good");
-				gdb_putback_char(connection, reply);
-				return ERROR_OK;
-			} else {
 
-				LOG_ERROR("unknown character(1) 0x%2.2x in reply, dropping connection", reply);
-				gdb_con->closed = 1;
-				return ERROR_SERVER_REMOTE_CLOSED;
-			}
-		}
-		else if (reply == '$') {
-			LOG_ERROR("GDB missing ack(2) - assumed good");
-			gdb_putback_char(connection, reply);
-			return ERROR_OK;
-		}
-		else
-		{
-			LOG_ERROR("unknown character(2) 0x%2.2x in reply, dropping connection", reply);
-			gdb_con->closed = 1;
-			return ERROR_SERVER_REMOTE_CLOSED;
-		}
+		bool resend;
+		if ((retval = gdb_get_packet_ack(connection, &resend)) != ERROR_OK)
+			return retval;
+		if (!resend)
+			break;
 	}
 	if (gdb_con->closed)
 		return ERROR_SERVER_REMOTE_CLOSED;
@@ -500,6 +572,19 @@ int gdb_put_packet(struct connection *connection, char *buffer, int len)
 	return retval;
 }
 
+static int gdb_put_frame(struct connection *connection, char *frame, int frame_len)
+{
+	struct gdb_connection *gdb_con = connection->priv;
+	gdb_con->busy = 1;
+	int retval = gdb_put_frame_inner(connection, frame, frame_len);
+	gdb_con->busy = 0;
+
+	/* we sent some data, reset timer for keep alive messages */
+	kept_alive();
+
+	return retval;
+}
+
 static __inline__ int fetch_packet(struct connection *connection, int *checksum_ok, int noack, int *len, char *buffer)
 {
 	unsigned char my_checksum = 0;
@@ -785,6 +870,22 @@ static int gdb_target_callback_event_handler(struct target *target,
 	int retval;
 	struct connection *connection = priv;
 
+	/* GDB was told its writes are done, so they must land before
+	 * anything else happens to the target */
+	switch (event)
+	{
+		case TARGET_EVENT_HALTED:
+		case TARGET_EVENT_RESUME_START:
+		case TARGET_EVENT_RESUMED:
+		case TARGET_EVENT_RESET_START:
+		case TARGET_EVENT_GDB_FLASH_ERASE_START:
+		case TARGET_EVENT_GDB_FLASH_WRITE_START:
+			gdb_write_behind_flush(connection);
+			break;
+		default:
+			break;
+	}
+
 	target_handle_event(target, event);
 	switch (event)
 	{
@@ -828,6 +929,11 @@ static int gdb_new_connection(struct connection *connection)
 	gdb_connection->noack_mode = 0;
 	gdb_connection->sync = true;
 	gdb_connection->mem_write_error = false;
+	gdb_connection->write_behind = NULL;
+	gdb_connection->write_behind_address = 0;
+	gdb_connection->write_behind_count = 0;
+	gdb_connection->write_behind_timer = false;
+	gdb_connection->write_behind_next = NULL;
 
 	/* send ACK to GDB for debug request */
 	gdb_write(connection, "+", 1);
@@ -905,6 +1011,14 @@ static int gdb_connection_closed(struct connection *connection)
 		  target_state_name(gdb_service->target),
 		  gdb_actual_connections);
 
+	/* GDB was told these writes succeeded, so do them before letting go */
+	gdb_write_behind_flush(connection);
+	if (gdb_connection->write_behind_timer)
+		target_unregister_timer_callback(gdb_write_behind_timeout, connection);
+	free(gdb_connection->write_behind);
+
+	target_restore_working_memory(gdb_service->target);
+
 	/* see if an image built with vFlash commands is left */
 	if (gdb_connection->vflash_image)
 	{
@@ -1159,6 +1273,12 @@ static int gdb_get_register_packet(struct connection *connection,
 	LOG_DEBUG("-");
 #endif
 
+	if ((target->rtos != NULL) &&
+			(ERROR_FAIL != rtos_get_gdb_reg(connection, target, reg_num)))
+	{
+		return ERROR_OK;
+	}
+
 	if ((retval = target_get_gdb_reg_list(target, &reg_list, &reg_list_size)) != ERROR_OK)
 	{
 		return gdb_error(connection, retval);
@@ -1243,10 +1363,69 @@ static int gdb_error(struct connection *connection, int retval)
 	return ERROR_OK;
 }
 
+/* Worst case size of a framed memory reply: '$', 'b', every byte escaped
+ * and "#cc". The target data is read into the last len bytes of the frame
+ * and gdb_frame_memory() encodes it in place; the write position never
+ * overtakes the read position. */
+#define GDB_MEMORY_FRAME_SIZE(len)	(2 * (size_t)(len) + 5)
+
+/* Frame len bytes of memory as a reply packet, hex encoded for 'm' or as
+ * 'b' followed by escaped binary data for 'x', computing the checksum in
+ * the same pass. Returns the length of the frame. */
+static int gdb_frame_memory(char *frame, const uint8_t *data, uint32_t len, bool binary)
+{
+	unsigned char checksum = 0;
+	char *p = frame;
+	uint32_t i;
+
+	*p++ = '$';
+
+	if (binary)
+	{
+		*p++ = 'b';
+		checksum += 'b';
+
+		for (i = 0; i < len; i++)
+		{
+			uint8_t t = data[i];
+
+			/* '*' is escaped too, lest it be taken for run length encoding */
+			if ((t == '$') || (t == '#') || (t == '}') || (t == '*'))
+			{
+				*p++ = '}';
+				checksum += '}';
+				t ^= 0x20;
+			}
+			*p++ = t;
+			checksum += t;
+		}
+	}
+	else
+	{
+		for (i = 0; i < len; i++)
+		{
+			uint8_t t = data[i];
+			char hi = DIGITS[(t >> 4) & 0xf];
+			char lo = DIGITS[t & 0xf];
+
+			*p++ = hi;
+			*p++ = lo;
+			checksum += hi + lo;
+		}
+	}
+
+	*p++ = '#';
+	*p++ = DIGITS[(checksum >> 4) & 0xf];
+	*p++ = DIGITS[checksum & 0xf];
+
+	return p - frame;
+}
+
 /* We don't have to worry about the default 2 second timeout for GDB packets,
  * because GDB breaks up large memory reads into smaller reads.
  *
- * 8191 bytes by the looks of it. Why 8191 bytes instead of 8192?????
+ * Handles both the hex encoded 'm' packet and the binary 'x' packet, which
+ * GDB uses when we advertise binary-upload+.
  */
 static int gdb_read_memory_packet(struct connection *connection,
 		struct target *target, char *packet, int packet_size)
@@ -1254,9 +1433,10 @@ static int gdb_read_memory_packet(struct connection *connection,
 	char *separator;
 	uint32_t addr = 0;
 	uint32_t len = 0;
+	bool binary = (packet[0] == 'x');
 
 	uint8_t *buffer;
-	char *hex_buffer;
+	char *frame;
 
 	int retval = ERROR_OK;
 
@@ -1273,7 +1453,16 @@ static int gdb_read_memory_packet(struct connection *connection,
 
 	len = strtoul(separator + 1, NULL, 16);
 
-	buffer = malloc(len);
+	frame = NULL;
+	/* keep the frame length within an int */
+	if (len < 0x40000000)
+		frame = malloc(GDB_MEMORY_FRAME_SIZE(len));
+	if (frame == NULL)
+	{
+		LOG_ERROR("can't allocate a reply for 0x%8.8" PRIx32 " bytes", len);
+		return gdb_error(connection, ERROR_FAIL);
+	}
+	buffer = (uint8_t *)frame + GDB_MEMORY_FRAME_SIZE(len) - len;
 
 	LOG_DEBUG("addr: 0x%8.8" PRIx32 ", len: 0x%8.8" PRIx32 "", addr, len);
 
@@ -1299,26 +1488,15 @@ static int gdb_read_memory_packet(struct connection *connection,
 
 	if (retval == ERROR_OK)
 	{
-		hex_buffer = malloc(len * 2 + 1);
-
-		uint32_t i;
-		for (i = 0; i < len; i++)
-		{
-			uint8_t t = buffer[i];
-			hex_buffer[2 * i] = DIGITS[(t >> 4) & 0xf];
-			hex_buffer[2 * i + 1] = DIGITS[t & 0xf];
-		}
-
-		gdb_put_packet(connection, hex_buffer, len * 2);
-
-		free(hex_buffer);
+		int frame_len = gdb_frame_memory(frame, buffer, len, binary);
+		gdb_put_frame(connection, frame, frame_len);
 	}
 	else
 	{
 		retval = gdb_error(connection, retval);
 	}
 
-	free(buffer);
+	free(frame);
 
 	return retval;
 }
@@ -1381,6 +1559,83 @@ static int gdb_write_memory_packet(struct connection *connection,
 	return retval;
 }
 
+/* Write out X packet data held back by gdb_write_memory_binary_packet().
+ * A failure is latched in mem_write_error and reported to GDB at the
+ * next X packet or step/continue, as for a direct write.
+ */
+static int gdb_write_behind_flush(struct connection *connection)
+{
+	struct gdb_connection *gdb_connection = connection->priv;
+	struct gdb_service *gdb_service = connection->service->priv;
+	struct connection **p;
+	int retval;
+
+	if (gdb_connection->write_behind_count == 0)
+		return ERROR_OK;
+
+	for (p = &gdb_write_behind_pending; *p;
+			p = &((struct gdb_connection *)(*p)->priv)->write_behind_next)
+	{
+		if (*p == connection)
+		{
+			*p = gdb_connection->write_behind_next;
+			break;
+		}
+	}
+	gdb_connection->write_behind_next = NULL;
+
+	LOG_DEBUG("addr: 0x%8.8" PRIx32 ", len: 0x%8.8" PRIx32 "",
+			gdb_connection->write_behind_address,
+			gdb_connection->write_behind_count);
+
+	retval = target_write_buffer(gdb_service->target,
+			gdb_connection->write_behind_address,
+			gdb_connection->write_behind_count,
+			gdb_connection->write_behind);
+	gdb_connection->write_behind_count = 0;
+
+	if (retval != ERROR_OK)
+		gdb_connection->mem_write_error = true;
+
+	return retval;
+}
+
+/* Write out what all GDB connections but @a keep hold back. */
+static void gdb_write_behind_flush_all(struct connection *keep)
+{
+	struct connection *c = gdb_write_behind_pending;
+
+	while (c)
+	{
+		struct connection *next = ((struct gdb_connection *)c->priv)->write_behind_next;
+
+		if (c != keep)
+			gdb_write_behind_flush(c);
+		c = next;
+	}
+}
+
+/* Sync point for everyone else driving the targets, e.g. a telnet or
+ * Tcl command that may reset the target or program flash. */
+void gdb_write_behind_sync(void)
+{
+	gdb_write_behind_flush_all(NULL);
+}
+
+/* Flushes held back writes when GDB has gone quiet without another sync
+ * point, e.g. after a single "set var" on a running target. */
+static int gdb_write_behind_timeout(void *priv)
+{
+	struct connection *connection = priv;
+	struct gdb_connection *gdb_connection = connection->priv;
+
+	/* one shot, the target code unregisters us after we return */
+	gdb_connection->write_behind_timer = false;
+	gdb_write_behind_flush(connection);
+
+	return ERROR_OK;
+}
+
 static int gdb_write_memory_binary_packet(struct connection *connection,
 		struct target *target, char *packet, int packet_size)
 {
@@ -1431,7 +1686,17 @@ static int gdb_write_memory_binary_packet(struct connection *connection,
 			return retval;
 	}
 
-	if (len)
+	if (len == 0)
+		return ERROR_OK;
+
+	/* Start a new run unless this packet continues the one held back.
+	 * Oversized packets skip the buffer altogether. */
+	if ((gdb_connection->write_behind_count > 0)
+		&& ((addr != gdb_connection->write_behind_address + gdb_connection->write_behind_count)
+			|| (gdb_connection->write_behind_count + len > GDB_WRITE_BEHIND_SIZE)))
+		gdb_write_behind_flush(connection);
+
+	if (len > GDB_WRITE_BEHIND_SIZE)
 	{
 		LOG_DEBUG("addr: 0x%8.8" PRIx32 ", len: 0x%8.8" PRIx32 "", addr, len);
 
@@ -1440,8 +1705,37 @@ static int gdb_write_memory_binary_packet(struct connection *connection,
 		{
 			gdb_connection->mem_write_error = true;
 		}
+		return ERROR_OK;
+	}
+
+	if (gdb_connection->write_behind == NULL)
+	{
+		gdb_connection->write_behind = malloc(GDB_WRITE_BEHIND_SIZE);
+		if (gdb_connection->write_behind == NULL)
+		{
+			LOG_ERROR("can't allocate the memory write buffer");
+			gdb_connection->mem_write_error = true;
+			return ERROR_OK;
+		}
 	}
 
+	if (gdb_connection->write_behind_count == 0)
+	{
+		gdb_connection->write_behind_address = addr;
+		gdb_connection->write_behind_next = gdb_write_behind_pending;
+		gdb_write_behind_pending = connection;
+	}
+	memcpy(gdb_connection->write_behind + gdb_connection->write_behind_count,
+			separator, len);
+	gdb_connection->write_behind_count += len;
+
+	/* restart the idle timer, it fires once GDB has been quiet long enough */
+	if (gdb_connection->write_behind_timer)
+		target_unregister_timer_callback(gdb_write_behind_timeout, connection);
+	gdb_connection->write_behind_timer = true;
+	target_register_timer_callback(gdb_write_behind_timeout,
+			GDB_WRITE_BEHIND_MS, 0, connection);
+
 	return ERROR_OK;
 }
 
@@ -1903,7 +2197,7 @@ static int gdb_query_packet(struct connection *connection,
 		int size = 0;
 
 		xml_printf(&retval, &buffer, &pos, &size,
-				"PacketSize=%x;qXfer:memory-map:read%c;qXfer:features:read-;QStartNoAckMode+",
+				"PacketSize=%x;qXfer:memory-map:read%c;qXfer:features:read-;QStartNoAckMode+;binary-upload+",
 				(GDB_BUFFER_SIZE - 1), ((gdb_use_memory_map == 1) && (flash_get_bank_count() > 0)) ? '+' : '-');
 
 		if (retval != ERROR_OK)
@@ -2123,6 +2417,9 @@ static int gdb_detach(struct connection *connection, struct target *target)
 {
 	struct gdb_service *gdb_service = connection->service->priv;
 
+	/* the target may be left halted, but its memory should be intact */
+	target_restore_working_memory(gdb_service->target);
+
 	target_call_event_callbacks(gdb_service->target,
 			TARGET_EVENT_GDB_DETACH);
 
@@ -2203,6 +2500,13 @@ static int gdb_input_inner(struct connection *connection)
 
 		if (packet_size > 0)
 		{
+			/* anything but another X packet is a sync point for
+			 * the memory writes held back so far; other GDB
+			 * connections must not overtake them either */
+			gdb_write_behind_flush_all(connection);
+			if (packet[0] != 'X')
+				gdb_write_behind_flush(connection);
+
 			retval = ERROR_OK;
 			switch (packet[0])
 			{
@@ -2245,6 +2549,7 @@ static int gdb_input_inner(struct connection *connection)
 							packet, packet_size);
 					break;
 				case 'm':
+				case 'x':
 					retval = gdb_read_memory_packet(
 							connection, target,
 							packet, packet_size);
@@ -33,12 +33,13 @@ struct image;
 struct reg;
 #include <target/target.h>
 
-#define GDB_BUFFER_SIZE	16384
+#define GDB_BUFFER_SIZE	65536
 
 int gdb_target_add_all(struct target *target);
 int gdb_register_commands(struct command_context *command_context);
 
 int gdb_put_packet(struct connection *connection, char *buffer, int len);
+void gdb_write_behind_sync(void);
 
 #define ERROR_GDB_BUFFER_TOO_SMALL (-800)
 #define ERROR_GDB_TIMEOUT (-801)
@@ -39,12 +39,138 @@
 #include <netinet/tcp.h>
 #endif
 
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
+
+/* readiness flags recorded in service/connection ->ready by server_wait() */
+#define SERVER_READY_READ	1
+#define SERVER_READY_WRITE	2
+
+/* connection_write() waits for the peer rather than buffer beyond this */
+#define CONNECTION_OUT_MAX	(256 * 1024)
 
 static struct service *services = NULL;
 
 /* shutdown_openocd == 1: exit the main event loop, and quit the debugger */
 static int shutdown_openocd = 0;
 
+#ifdef HAVE_SYS_EPOLL_H
+/* epoll instance used by server_loop(), -1 means select() is used */
+static int server_epoll_fd = -1;
+#endif
+
+/* (Re)register fd with the epoll set; events land in *ready. Without
+ * epoll this is a no-op, the select() path rebuilds its sets every time. */
+static void server_watch(int fd, int *ready, bool want_write)
+{
+#ifdef HAVE_SYS_EPOLL_H
+	struct epoll_event ev;
+
+	if ((server_epoll_fd == -1) || (fd == -1))
+		return;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN | (want_write ? EPOLLOUT : 0);
+	ev.data.ptr = ready;
+
+	if (epoll_ctl(server_epoll_fd, EPOLL_CTL_MOD, fd, &ev) == 0)
+		return;
+	if ((errno == ENOENT)
+		&& (epoll_ctl(server_epoll_fd, EPOLL_CTL_ADD, fd, &ev) == 0))
+		return;
+
+	/* e.g. stdin redirected from a regular file, which epoll refuses */
+	LOG_DEBUG("epoll_ctl failed for fd %d: %s, falling back to select()",
+			fd, strerror(errno));
+	close(server_epoll_fd);
+	server_epoll_fd = -1;
+#endif
+}
+
+static void server_unwatch(int fd)
+{
+#ifdef HAVE_SYS_EPOLL_H
+	struct epoll_event ev;
+
+	if ((server_epoll_fd == -1) || (fd == -1))
+		return;
+
+	/* pre 2.6.9 kernels want a non-NULL event even for EPOLL_CTL_DEL */
+	memset(&ev, 0, sizeof(ev));
+	epoll_ctl(server_epoll_fd, EPOLL_CTL_DEL, fd, &ev);
+#endif
+}
+
+static bool connection_would_block(void)
+{
+#ifdef _WIN32
+	return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+	return (errno == EAGAIN) || (errno == EWOULDBLOCK);
+#endif
+}
+
+/* write out as much buffered output as the socket takes without blocking */
+static int connection_drain(struct connection *connection)
+{
+	int retval = ERROR_OK;
+
+	while (connection->out_count > 0)
+	{
+		int count = write_socket(connection->fd_out,
+				connection->out_buffer, connection->out_count);
+		if (count < 0)
+		{
+			if (connection_would_block())
+				return ERROR_OK;
+
+			/* peer is gone, the next read will report it */
+			connection->out_count = 0;
+			retval = ERROR_SERVER_REMOTE_CLOSED;
+			break;
+		}
+
+		connection->out_count -= count;
+		memmove(connection->out_buffer, connection->out_buffer + count,
+				connection->out_count);
+	}
+
+	server_watch(connection->fd, &connection->ready, false);
+
+	return retval;
+}
+
+static int connection_buffer(struct connection *connection, const void *data, int len)
+{
+	if (connection->out_count + len > connection->out_size)
+	{
+		int size = connection->out_size ? connection->out_size : 4096;
+		char *buffer;
+
+		while (connection->out_count + len > size)
+			size *= 2;
+
+		buffer = realloc(connection->out_buffer, size);
+		if (buffer == NULL)
+		{
+			LOG_ERROR("out of memory buffering '%s' output",
+					connection->service->name);
+			return ERROR_FAIL;
+		}
+		connection->out_buffer = buffer;
+		connection->out_size = size;
+	}
+
+	if (connection->out_count == 0)
+		server_watch(connection->fd, &connection->ready, true);
+
+	memcpy(connection->out_buffer + connection->out_count, data, len);
+	connection->out_count += len;
+
+	return ERROR_OK;
+}
+
 static int add_connection(struct service *service, struct command_context *cmd_ctx)
 {
 	socklen_t address_size;
@@ -59,6 +185,10 @@ static int add_connection(struct service *service, struct command_context *cmd_c
 	c->cmd_ctx = copy_command_context(cmd_ctx);
 	c->service = service;
 	c->input_pending = 0;
+	c->out_buffer = NULL;
+	c->out_size = 0;
+	c->out_count = 0;
+	c->ready = 0;
 	c->priv = NULL;
 	c->next = NULL;
 
@@ -77,6 +207,9 @@ static int add_connection(struct service *service, struct command_context *cmd_c
 				(char *)&flag,		/* the cast is historical cruft */
 				sizeof(int));		/* length of option value */
 
+		/* writes that would block are buffered by connection_write() */
+		socket_nonblock(c->fd);
+
 		LOG_INFO("accepting '%s' connection from %s", service->name, service->port);
 		if ((retval = service->new_connection(c)) != ERROR_OK)
 		{
@@ -133,6 +266,9 @@ static int add_connection(struct service *service, struct command_context *cmd_c
 	for (p = &service->connections; *p; p = &(*p)->next);
 	*p = c;
 
+	/* for pipes this takes the fd over from the listening service */
+	server_watch(c->fd, &c->ready, false);
+
 	service->max_connections--;
 
 	return ERROR_OK;
@@ -151,17 +287,25 @@ static int remove_connection(struct service *service, struct connection *connect
 			service->connection_closed(c);
 			if (service->type == CONNECTION_TCP)
 			{
+				/* last chance for e.g. a goodbye message, don't wait for it */
+				connection_drain(c);
+				server_unwatch(c->fd);
 				close_socket(c->fd);
 			} else if (service->type == CONNECTION_PIPE)
 			{
 				/* The service will listen to the pipe again */
 				c->service->fd = c->fd;
+				server_watch(c->service->fd, &c->service->ready, false);
+			} else
+			{
+				server_unwatch(c->fd);
 			}
 
 			command_done(c->cmd_ctx);
 
 			/* delete connection */
 			*p = c->next;
+			free(c->out_buffer);
 			free(c);
 
 			service->max_connections++;
@@ -191,6 +335,7 @@ int add_service(char *name, const char *port, int max_connections, new_connectio
 	c->new_connection = new_connection_handler;
 	c->input = input_handler;
 	c->connection_closed = connection_closed_handler;
+	c->ready = 0;
 	c->priv = priv;
 	c->next = NULL;
 	long portnumber;
@@ -293,6 +438,8 @@ int add_service(char *name, const char *port, int max_connections, new_connectio
 	for (p = &services; *p; p = &(*p)->next);
 	*p = c;
 
+	server_watch(c->fd, &c->ready, false);
+
 	return ERROR_OK;
 }
 
@@ -331,72 +478,157 @@ static int remove_services(void)
 	return ERROR_OK;
 }
 
-int server_loop(struct command_context *command_context)
+static void server_epoll_init(void)
 {
+#ifdef HAVE_SYS_EPOLL_H
 	struct service *service;
 
-	bool poll_ok = true;
+	server_epoll_fd = epoll_create(16);
+	if (server_epoll_fd == -1)
+	{
+		LOG_DEBUG("epoll_create failed: %s, using select()", strerror(errno));
+		return;
+	}
+
+	for (service = services; service; service = service->next)
+	{
+		struct connection *c;
 
-	/* used in select() */
-	fd_set read_fds;
-	int fd_max;
+		server_watch(service->fd, &service->ready, false);
+		for (c = service->connections; c; c = c->next)
+			server_watch(c->fd, &c->ready, c->out_count > 0);
+	}
+#endif
+}
 
-	/* used in accept() */
+/* Wait up to timeout_ms (0 just polls) for activity and record it in the
+ * ready flags of the services and connections. Returns the number of
+ * ready descriptors, 0 on timeout or -1 with errno set. */
+static int server_wait(int timeout_ms)
+{
+	struct service *service;
+	struct connection *c;
 	int retval;
 
-#ifndef _WIN32
-	if (signal(SIGPIPE, SIG_IGN) == SIG_ERR)
-		LOG_ERROR("couldn't set SIGPIPE to SIG_IGN");
+	for (service = services; service; service = service->next)
+	{
+		service->ready = 0;
+		for (c = service->connections; c; c = c->next)
+			c->ready = 0;
+	}
+
+#ifdef HAVE_SYS_EPOLL_H
+	if (server_epoll_fd != -1)
+	{
+		struct epoll_event events[16];
+		int i;
+
+		retval = epoll_wait(server_epoll_fd, events, ARRAY_SIZE(events), timeout_ms);
+
+		/* translate everything before any handler can free a connection */
+		for (i = 0; i < retval; i++)
+		{
+			int *ready = events[i].data.ptr;
+
+			if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+				*ready |= SERVER_READY_READ;
+			if (events[i].events & EPOLLOUT)
+				*ready |= SERVER_READY_WRITE;
+		}
+		return retval;
+	}
 #endif
 
-	while (!shutdown_openocd)
+	fd_set read_fds, write_fds;
+	int fd_max = 0;
+
+	FD_ZERO(&read_fds);
+	FD_ZERO(&write_fds);
+
+	/* add service and connection fds to read_fds */
+	for (service = services; service; service = service->next)
 	{
-		/* monitor sockets for activity */
-		fd_max = 0;
-		FD_ZERO(&read_fds);
+		if (service->fd != -1)
+		{
+			/* listen for new connections */
+			FD_SET(service->fd, &read_fds);
 
-		/* add service and connection fds to read_fds */
-		for (service = services; service; service = service->next)
+			if (service->fd > fd_max)
+				fd_max = service->fd;
+		}
+
+		for (c = service->connections; c; c = c->next)
 		{
-			if (service->fd != -1)
-			{
-				/* listen for new connections */
-				FD_SET(service->fd, &read_fds);
+			/* check for activity on the connection */
+			FD_SET(c->fd, &read_fds);
+			if (c->out_count > 0)
+				FD_SET(c->fd, &write_fds);
+			if (c->fd > fd_max)
+				fd_max = c->fd;
+		}
+	}
 
-				if (service->fd > fd_max)
-					fd_max = service->fd;
-			}
+	struct timeval tv;
+	tv.tv_sec = 0;
+	tv.tv_usec = timeout_ms * 1000;
+	retval = socket_select(fd_max + 1, &read_fds, &write_fds, NULL, &tv);
 
-			if (service->connections)
-			{
-				struct connection *c;
+	/* eCos leaves the fd_sets unchanged on timeout, so only look at them
+	 * when something actually happened */
+	if (retval <= 0)
+		return retval;
 
-				for (c = service->connections; c; c = c->next)
-				{
-					/* check for activity on the connection */
-					FD_SET(c->fd, &read_fds);
-					if (c->fd > fd_max)
-						fd_max = c->fd;
-				}
-			}
+	for (service = services; service; service = service->next)
+	{
+		if ((service->fd != -1) && FD_ISSET(service->fd, &read_fds))
+			service->ready |= SERVER_READY_READ;
+
+		for (c = service->connections; c; c = c->next)
+		{
+			if (FD_ISSET(c->fd, &read_fds))
+				c->ready |= SERVER_READY_READ;
+			if (FD_ISSET(c->fd, &write_fds))
+				c->ready |= SERVER_READY_WRITE;
 		}
+	}
+
+	return retval;
+}
+
+int server_loop(struct command_context *command_context)
+{
+	struct service *service;
+
+	bool poll_ok = true;
+
+	/* used in accept() */
+	int retval;
+
+#ifndef _WIN32
+	if (signal(SIGPIPE, SIG_IGN) == SIG_ERR)
+		LOG_ERROR("couldn't set SIGPIPE to SIG_IGN");
+#endif
 
-		struct timeval tv;
-		tv.tv_sec = 0;
+	server_epoll_init();
+
+	while (!shutdown_openocd)
+	{
 		if (poll_ok)
 		{
 			/* we're just polling this iteration, this is faster on embedded
 			 * hosts */
-			tv.tv_usec = 0;
-			retval = socket_select(fd_max + 1, &read_fds, NULL, NULL, &tv);
+			retval = server_wait(0);
 		} else
 		{
-			/* Every 100ms */
-			tv.tv_usec = 100000;
+			/* Sleep until the next timer callback is due, at most 100ms */
+			int timeout_ms = target_timer_callbacks_next_ms();
+			if ((timeout_ms < 0) || (timeout_ms > 100))
+				timeout_ms = 100;
+
 			/* Only while we're sleeping we'll let others run */
 			openocd_sleep_prelude();
 			kept_alive();
-			retval = socket_select(fd_max + 1, &read_fds, NULL, NULL, &tv);
+			retval = server_wait(timeout_ms);
 			openocd_sleep_postlude();
 		}
 
@@ -406,20 +638,14 @@ int server_loop(struct command_context *command_context)
 
 			errno = WSAGetLastError();
 
-			if (errno == WSAEINTR)
-				FD_ZERO(&read_fds);
-			else
+			if (errno != WSAEINTR)
 			{
 				LOG_ERROR("error during select: %s", strerror(errno));
 				exit(-1);
 			}
 #else
 
-			if (errno == EINTR)
-			{
-				FD_ZERO(&read_fds);
-			}
-			else
+			if (errno != EINTR)
 			{
 				LOG_ERROR("error during select: %s", strerror(errno));
 				exit(-1);
@@ -433,8 +659,6 @@ int server_loop(struct command_context *command_context)
 			target_call_timer_callbacks();
 			process_jim_events(command_context);
 
-			FD_ZERO(&read_fds); /* eCos leaves read_fds unchanged in this case!  */
-
 			/* We timed out/there was nothing to do, timeout rather than poll next time */
 			poll_ok = false;
 		} else
@@ -447,7 +671,7 @@ int server_loop(struct command_context *command_context)
 		{
 			/* handle new connections on listeners */
 			if ((service->fd != -1)
-				&& (FD_ISSET(service->fd, &read_fds)))
+				&& (service->ready & SERVER_READY_READ))
 			{
 				if (service->max_connections > 0)
 				{
@@ -474,7 +698,11 @@ int server_loop(struct command_context *command_context)
 
 				for (c = service->connections; c;)
 				{
-					if ((FD_ISSET(c->fd, &read_fds)) || c->input_pending)
+					/* push out whatever connection_write() had to hold back */
+					if (c->ready & SERVER_READY_WRITE)
+						connection_drain(c);
+
+					if ((c->ready & SERVER_READY_READ) || c->input_pending)
 					{
 						if ((retval = service->input(c)) != ERROR_OK)
 						{
@@ -563,6 +791,14 @@ int server_quit(void)
 {
 	remove_services();
 
+#ifdef HAVE_SYS_EPOLL_H
+	if (server_epoll_fd != -1)
+	{
+		close(server_epoll_fd);
+		server_epoll_fd = -1;
+	}
+#endif
+
 #ifdef _WIN32
 	WSACleanup();
 	SetConsoleCtrlHandler(ControlHandler, FALSE);
@@ -578,13 +814,61 @@ int connection_write(struct connection *connection, const void *data, int len)
 		/* successful no-op. Sockets and pipes behave differently here... */
 		return 0;
 	}
-	if (connection->service->type == CONNECTION_TCP)
-	{
-		return write_socket(connection->fd_out, data, len);
-	} else
+	if (connection->service->type != CONNECTION_TCP)
 	{
 		return write(connection->fd_out, data, len);
 	}
+
+	/* Write straight through unless output is already queued, which
+	 * would reorder the stream. Whatever the socket won't take now is
+	 * buffered and drained from server_loop() once it is writable. */
+	int count = 0;
+	if (connection->out_count == 0)
+	{
+		count = write_socket(connection->fd_out, data, len);
+		if (count == len)
+			return len;
+		if (count < 0)
+		{
+			if (!connection_would_block())
+				return count;
+			count = 0;
+		}
+	}
+
+	if (connection_buffer(connection, (const char *)data + count, len - count) != ERROR_OK)
+		return -1;
+
+	/* a peer that stops reading must not make us buffer without bound */
+	if ((connection->out_count > CONNECTION_OUT_MAX)
+		&& (connection_flush(connection) != ERROR_OK))
+		return -1;
+
+	return len;
+}
+
+int connection_flush(struct connection *connection)
+{
+	while (connection->out_count > 0)
+	{
+		int retval = connection_drain(connection);
+		if (retval != ERROR_OK)
+			return retval;
+		if (connection->out_count == 0)
+			break;
+
+		fd_set write_fds;
+		FD_ZERO(&write_fds);
+		FD_SET(connection->fd_out, &write_fds);
+		if ((socket_select(connection->fd_out + 1, NULL, &write_fds, NULL, NULL) == -1)
+			&& (errno != EINTR))
+		{
+			LOG_ERROR("error during select: %s", strerror(errno));
+			return ERROR_SERVER_REMOTE_CLOSED;
+		}
+	}
+
+	return ERROR_OK;
 }
 
 int connection_read(struct connection *connection, void *data, int len)
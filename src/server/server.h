@@ -47,6 +47,12 @@ struct connection
 	struct command_context *cmd_ctx;
 	struct service *service;
 	int input_pending;
+	/* output that could not be written without blocking, drained by
+	 * server_loop() once the socket becomes writable */
+	char *out_buffer;
+	int out_size;
+	int out_count;
+	int ready; /* SERVER_READY_xxx flags from the last wait */
 	void *priv;
 	struct connection *next;
 };
@@ -68,6 +74,7 @@ struct service
 	new_connection_handler_t new_connection;
 	input_handler_t input;
 	connection_closed_handler_t connection_closed;
+	int ready;
 	void *priv;
 	struct service *next;
 };
@@ -87,6 +94,12 @@ int server_register_commands(struct command_context *context);
 
 int connection_write(struct connection *connection, const void *data, int len);
 int connection_read(struct connection *connection, void *data, int len);
+/**
+ * Blocks until any output buffered by connection_write() has been sent.
+ * Protocols that wait for a reply to what they just wrote must call this
+ * before blocking on input.
+ */
+int connection_flush(struct connection *connection);
 
 /**
  * Used by server_loop(), defined in server_stubs.c or ecosboard.c
@@ -23,6 +23,7 @@
 #endif
 
 #include "tcl_server.h"
+#include "gdb_server.h"
 
 
 #define TCL_SERVER_VERSION	"TCL Server 0.1"
@@ -131,6 +132,7 @@ static int tcl_input(struct connection *connection)
 		else {
 			tclc->tc_line[tclc->tc_lineoffset-1] = '\0';
 			LOG_DEBUG("Executing script:\n %s", tclc->tc_line);
+			gdb_write_behind_sync();
 			retval = Jim_Eval_Named(interp, tclc->tc_line, "remote:connection",1);
 			LOG_DEBUG("Result: %d\n %s", retval, Jim_GetString(Jim_GetResult(interp), &reslen));
 			result = Jim_GetString(Jim_GetResult(interp), &reslen);
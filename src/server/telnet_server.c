@@ -28,6 +28,7 @@
 #endif
 
 #include "telnet_server.h"
+#include "gdb_server.h"
 #include <target/target_request.h>
 
 static const char *telnet_port;
@@ -328,6 +329,7 @@ static int telnet_input(struct connection *connection)
 
 							t_con->line_cursor = -1; /* to supress prompt in log callback during command execution */
 
+							gdb_write_behind_sync();
 							retval = command_run_line(command_context, t_con->line);
 
 							t_con->line_cursor = 0;
@@ -202,14 +202,27 @@ struct svf_check_tdo_para
 	int bit_len;		// bit length to check
 };
 
+/* Pending TDO checks, oldest first.  Each checked scan queues a callback
+ * right behind it, which takes the oldest entry and compares the captured
+ * data as the queue completes; so checks never force a flush themselves,
+ * only the data buffer filling up (SVF_MAX_BUFFER_SIZE_TO_COMMIT) does.
+ * The ring doubles when full.
+ */
 #define SVF_CHECK_TDO_PARA_SIZE	1024
 static struct svf_check_tdo_para *svf_check_tdo_para = NULL;
-static int svf_check_tdo_para_index = 0;
+static int svf_check_tdo_para_size = 0;
+static int svf_check_tdo_para_head = 0;
+static int svf_check_tdo_para_index = 0;	// number of pending checks
+static int svf_check_tdo_error = ERROR_OK;
+static int svf_last_scan_len = 0;
 
 static int svf_read_command_from_file(FILE * fd);
 static int svf_check_tdo(void);
 static int svf_add_check_para(uint8_t enabled, int buffer_offset, int bit_len);
+static int svf_check_tdo_callback(jtag_callback_data_t data0, jtag_callback_data_t data1,
+		jtag_callback_data_t data2, jtag_callback_data_t data3);
 static int svf_run_command(struct command_context *cmd_ctx, char *cmd_str);
+static int svf_execute_tap(void);
 
 static FILE * svf_fd = NULL;
 static char * svf_read_line = NULL;
@@ -219,6 +232,13 @@ static size_t svf_command_buffer_size = 0;
 static int svf_line_number = 1;
 static int svf_getline (char **lineptr, size_t *n, FILE *stream);
 
+/* svf_getline() reads the file in blocks of this size, a line at a time
+ * through stdio costs more than the whole rest of the parser
+ */
+#define SVF_READ_BUFFER_SIZE	(64 * 1024)
+static char *svf_read_buffer = NULL;
+static size_t svf_read_buffer_pos = 0, svf_read_buffer_len = 0;
+
 #define SVF_MAX_BUFFER_SIZE_TO_COMMIT	(1024 * 1024)
 static uint8_t *svf_tdi_buffer = NULL, *svf_tdo_buffer = NULL, *svf_mask_buffer = NULL;
 static int svf_buffer_index = 0, svf_buffer_size = 0;
@@ -235,6 +255,170 @@ static long svf_total_lines = 0;
 static int svf_percentage = 0;
 static int svf_last_printed_percentage = -1;
 
+// Compiled SVF cache
+/*
+ * With "cache <dir>", everything a run of an SVF file puts into the JTAG
+ * queue is also recorded, in a compact binary form, into a file named
+ * after a hash of the SVF text and of the chain padding.  Later runs of
+ * the same file replay that recording straight into the JTAG queue and
+ * skip the text parser entirely.
+ *
+ * The recording is a header (SVF_CACHE_MAGIC, 64 bit key) followed by
+ * operations, each an svf_op byte and its little endian arguments:
+ *
+ *	TLR
+ *	PATHMOVE	u32 count, count state bytes
+ *	IR_SCAN, DR_SCAN	u32 bits, u8 end state, u8 check, u32 line,
+ *			TDI bytes, and TDO and MASK bytes if check is set
+ *	CLOCKS		u32 count
+ *	SLEEP		u32 microseconds
+ *	RESET		u8 trst, u8 srst
+ *	FREQUENCY	u32 kHz
+ *	FLUSH		(svf_execute_tap)
+ *	END		u32 number of SVF commands
+ */
+#define SVF_CACHE_MAGIC		"OOCDSVF1"
+#define SVF_CACHE_HEADER_SIZE	16
+
+enum svf_op
+{
+	SVF_OP_END,
+	SVF_OP_TLR,
+	SVF_OP_PATHMOVE,
+	SVF_OP_IR_SCAN,
+	SVF_OP_DR_SCAN,
+	SVF_OP_CLOCKS,
+	SVF_OP_SLEEP,
+	SVF_OP_RESET,
+	SVF_OP_FREQUENCY,
+	SVF_OP_FLUSH,
+};
+
+static uint8_t *svf_compile_buffer = NULL;	/* non-NULL while recording */
+static size_t svf_compile_len = 0, svf_compile_size = 0;
+
+static void svf_compile(const void *data, size_t len)
+{
+	uint8_t *buffer;
+	size_t size;
+
+	if (svf_compile_buffer == NULL)
+		return;
+
+	if (svf_compile_len + len > svf_compile_size)
+	{
+		size = 2 * svf_compile_size;
+		while (size < svf_compile_len + len)
+			size *= 2;
+		buffer = realloc(svf_compile_buffer, size);
+		if (buffer == NULL)
+		{
+			/* give up recording, the run itself goes on */
+			LOG_WARNING("not enough memory to compile svf file");
+			free(svf_compile_buffer);
+			svf_compile_buffer = NULL;
+			return;
+		}
+		svf_compile_buffer = buffer;
+		svf_compile_size = size;
+	}
+
+	memcpy(svf_compile_buffer + svf_compile_len, data, len);
+	svf_compile_len += len;
+}
+
+static void svf_compile_u8(uint8_t value)
+{
+	svf_compile(&value, 1);
+}
+
+static void svf_compile_u32(uint32_t value)
+{
+	uint8_t buf[4];
+
+	h_u32_to_le(buf, value);
+	svf_compile(buf, 4);
+}
+
+/* JTAG queue operations of the SVF player, recorded while compiling */
+
+static void svf_queue_tlr(void)
+{
+	svf_compile_u8(SVF_OP_TLR);
+	if (!svf_nil)
+		jtag_add_tlr();
+}
+
+static void svf_queue_pathmove(int num_states, const tap_state_t *path)
+{
+	int i;
+
+	svf_compile_u8(SVF_OP_PATHMOVE);
+	svf_compile_u32(num_states);
+	for (i = 0; i < num_states; i++)
+		svf_compile_u8(path[i]);
+	if (!svf_nil)
+		jtag_add_pathmove(num_states, path);
+}
+
+static void svf_queue_clocks(int num_cycles)
+{
+	svf_compile_u8(SVF_OP_CLOCKS);
+	svf_compile_u32(num_cycles);
+	if (!svf_nil)
+		jtag_add_clocks(num_cycles);
+}
+
+static void svf_queue_sleep(uint32_t us)
+{
+	svf_compile_u8(SVF_OP_SLEEP);
+	svf_compile_u32(us);
+	if (!svf_nil)
+		jtag_add_sleep(us);
+}
+
+static void svf_queue_reset(int req_tlr_or_trst, int srst)
+{
+	svf_compile_u8(SVF_OP_RESET);
+	svf_compile_u8(req_tlr_or_trst);
+	svf_compile_u8(srst);
+	if (!svf_nil)
+		jtag_add_reset(req_tlr_or_trst, srst);
+}
+
+/* scan of the data assembled at svf_buffer_index, check para already added */
+static void svf_queue_scan(bool ir, int num_bits, bool check, tap_state_t end_state)
+{
+	uint8_t *tdi = &svf_tdi_buffer[svf_buffer_index];
+	int len = (num_bits + 7) >> 3;
+
+	svf_compile_u8(ir ? SVF_OP_IR_SCAN : SVF_OP_DR_SCAN);
+	svf_compile_u32(num_bits);
+	svf_compile_u8(end_state);
+	svf_compile_u8(check);
+	svf_compile_u32(svf_line_number);
+	svf_compile(tdi, len);
+	if (check)
+	{
+		svf_compile(&svf_tdo_buffer[svf_buffer_index], len);
+		svf_compile(&svf_mask_buffer[svf_buffer_index], len);
+	}
+
+	svf_last_scan_len = num_bits;
+	if (svf_nil)
+		return;
+
+	/* NOTE:  doesn't use SVF-specified state paths */
+	if (ir)
+		jtag_add_plain_ir_scan(num_bits, tdi, tdi, end_state);
+	else
+		jtag_add_plain_dr_scan(num_bits, tdi, tdi, end_state);
+
+	if (check)
+		jtag_add_callback4(svf_check_tdo_callback,
+				(jtag_callback_data_t)tdi, 0, 0, 0);
+}
+
 static void svf_free_xxd_para(struct svf_xxr_para *para)
 {
 	if (NULL != para)
@@ -292,7 +476,7 @@ int svf_add_statemove(tap_state_t state_to)
 		if (svf_nil)
 			return ERROR_OK;
 
-		jtag_add_tlr();
+		svf_queue_tlr();
 		return ERROR_OK;
 	}
 
@@ -307,10 +491,10 @@ int svf_add_statemove(tap_state_t state_to)
 			}
 			/* recorded path includes current state ... avoid extra TCKs! */
 			if (svf_statemoves[index_var].num_of_moves > 1)
-				jtag_add_pathmove(svf_statemoves[index_var].num_of_moves - 1,
+				svf_queue_pathmove(svf_statemoves[index_var].num_of_moves - 1,
 						svf_statemoves[index_var].paths + 1);
 			else
-				jtag_add_pathmove(svf_statemoves[index_var].num_of_moves,
+				svf_queue_pathmove(svf_statemoves[index_var].num_of_moves,
 						svf_statemoves[index_var].paths);
 			return ERROR_OK;
 		}
@@ -319,14 +503,269 @@ int svf_add_statemove(tap_state_t state_to)
 	return ERROR_FAIL;
 }
 
+/* FNV-1a, good enough to tell SVF files apart */
+static uint64_t svf_cache_hash(uint64_t hash, const void *data, size_t len)
+{
+	const uint8_t *p = data;
+
+	while (len--)
+	{
+		hash ^= *p++;
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+/* key of the recording: SVF text, and the padding for the selected TAP */
+static int svf_cache_key(FILE *fd, uint64_t *key)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	uint8_t *buffer, lens[16];
+	size_t len;
+
+	buffer = malloc(SVF_READ_BUFFER_SIZE);
+	if (buffer == NULL)
+	{
+		LOG_ERROR("not enough memory");
+		return ERROR_FAIL;
+	}
+	while ((len = fread(buffer, 1, SVF_READ_BUFFER_SIZE, fd)) > 0)
+		hash = svf_cache_hash(hash, buffer, len);
+	free(buffer);
+	if (ferror(fd))
+	{
+		LOG_ERROR("error while reading svf file");
+		return ERROR_FAIL;
+	}
+	rewind(fd);
+
+	h_u32_to_le(lens, svf_para.hir_para.len);
+	h_u32_to_le(lens + 4, svf_para.hdr_para.len);
+	h_u32_to_le(lens + 8, svf_para.tir_para.len);
+	h_u32_to_le(lens + 12, svf_para.tdr_para.len);
+	*key = svf_cache_hash(hash, lens, sizeof(lens));
+
+	return ERROR_OK;
+}
+
+/* read the whole recording for 'key' at 'path', NULL if there is none */
+static uint8_t *svf_cache_load(const char *path, uint64_t key, size_t *len)
+{
+	uint8_t *data;
+	FILE *fd;
+	long size;
+
+	fd = fopen(path, "rb");
+	if (fd == NULL)
+		return NULL;
+
+	data = NULL;
+	if ((fseek(fd, 0, SEEK_END) == 0) && ((size = ftell(fd)) > SVF_CACHE_HEADER_SIZE))
+	{
+		rewind(fd);
+		data = malloc(size);
+		if ((data != NULL) && ((fread(data, 1, size, fd) != (size_t)size)
+				|| memcmp(data, SVF_CACHE_MAGIC, 8)
+				|| (le_to_h_u32(data + 8) != (uint32_t)key)
+				|| (le_to_h_u32(data + 12) != (uint32_t)(key >> 32))))
+		{
+			free(data);
+			data = NULL;
+		}
+		*len = size;
+	}
+	fclose(fd);
+
+	if (data == NULL)
+		LOG_WARNING("ignoring unusable svf cache file \"%s\"", path);
+	return data;
+}
+
+/* store the finished recording, written aside first so readers never see half of it */
+static void svf_cache_save(const char *path)
+{
+	char *tmp_path;
+	FILE *fd;
+	bool ok;
+
+	tmp_path = alloc_printf("%s.tmp", path);
+	if (tmp_path == NULL)
+		return;
+
+	fd = fopen(tmp_path, "wb");
+	if (fd == NULL)
+	{
+		LOG_WARNING("cannot create svf cache file \"%s\": %s", tmp_path, strerror(errno));
+		free(tmp_path);
+		return;
+	}
+	ok = (fwrite(svf_compile_buffer, 1, svf_compile_len, fd) == svf_compile_len);
+	ok = (fclose(fd) == 0) && ok;
+	if (!ok || (rename(tmp_path, path) != 0))
+	{
+		LOG_WARNING("cannot write svf cache file \"%s\"", path);
+		unlink(tmp_path);
+	}
+	else
+		LOG_INFO("svf file compiled into \"%s\"", path);
+	free(tmp_path);
+}
+
+/**
+ * Replay a recording made by the svf_queue_*() functions into the JTAG queue.
+ * With 'dry' set the recording is only checked, so a damaged file is found
+ * before anything reaches the JTAG queue.
+ */
+static int svf_replay(struct command_context *cmd_ctx, const uint8_t *data,
+		size_t len, bool dry, int *command_num)
+{
+#define SVF_REPLAY_NEED(n) \
+	do { if ((len - pos) < (size_t)(n)) goto corrupt; } while (0)
+/* tap_state_t values are 0..15, whatever encoding is in use */
+#define SVF_REPLAY_STATE_MAX	15
+	tap_state_t path[256], *states;
+	size_t pos = SVF_CACHE_HEADER_SIZE;
+	uint32_t count, bits, line;
+	uint8_t op, end_state, check;
+	int bytes;
+	unsigned i;
+
+	for (;;)
+	{
+		SVF_REPLAY_NEED(1);
+		op = data[pos++];
+		switch (op)
+		{
+		case SVF_OP_END:
+			SVF_REPLAY_NEED(4);
+			*command_num = le_to_h_u32(data + pos);
+			pos += 4;
+			if (pos != len)
+				goto corrupt;
+			return ERROR_OK;
+		case SVF_OP_TLR:
+			if (!dry)
+				svf_queue_tlr();
+			break;
+		case SVF_OP_PATHMOVE:
+			SVF_REPLAY_NEED(4);
+			count = le_to_h_u32(data + pos);
+			pos += 4;
+			SVF_REPLAY_NEED(count);
+			for (i = 0; i < count; i++)
+			{
+				if (data[pos + i] > SVF_REPLAY_STATE_MAX)
+					goto corrupt;
+			}
+			if (!dry)
+			{
+				/* STATE paths are recorded at any length, like svf_run_command() takes them */
+				states = path;
+				if (count > ARRAY_SIZE(path))
+				{
+					states = malloc(count * sizeof(tap_state_t));
+					if (states == NULL)
+					{
+						LOG_ERROR("not enough memory");
+						return ERROR_FAIL;
+					}
+				}
+				for (i = 0; i < count; i++)
+					states[i] = data[pos + i];
+				svf_queue_pathmove(count, states);
+				if (states != path)
+					free(states);
+			}
+			pos += count;
+			break;
+		case SVF_OP_IR_SCAN:
+		case SVF_OP_DR_SCAN:
+			SVF_REPLAY_NEED(10);
+			bits = le_to_h_u32(data + pos);
+			end_state = data[pos + 4];
+			check = data[pos + 5];
+			line = le_to_h_u32(data + pos + 6);
+			pos += 10;
+			bytes = (bits + 7) >> 3;
+			if ((bits == 0) || (bytes > svf_buffer_size)
+					|| (end_state > SVF_REPLAY_STATE_MAX) || (check > 1))
+				goto corrupt;
+			SVF_REPLAY_NEED(check ? (3 * bytes) : bytes);
+			if (!dry)
+			{
+				if ((svf_buffer_size - svf_buffer_index) < bytes)
+				{
+					LOG_ERROR("buffer is not enough, report to author");
+					return ERROR_FAIL;
+				}
+				memcpy(&svf_tdi_buffer[svf_buffer_index], data + pos, bytes);
+				if (check)
+				{
+					memcpy(&svf_tdo_buffer[svf_buffer_index], data + pos + bytes, bytes);
+					memcpy(&svf_mask_buffer[svf_buffer_index], data + pos + 2 * bytes, bytes);
+				}
+				svf_line_number = line;
+				if (ERROR_OK != svf_add_check_para(check, svf_buffer_index, bits))
+					return ERROR_FAIL;
+				svf_queue_scan(op == SVF_OP_IR_SCAN, bits, check, end_state);
+				svf_buffer_index += bytes;
+			}
+			pos += check ? (3 * bytes) : bytes;
+			break;
+		case SVF_OP_CLOCKS:
+			SVF_REPLAY_NEED(4);
+			if (!dry)
+				svf_queue_clocks(le_to_h_u32(data + pos));
+			pos += 4;
+			break;
+		case SVF_OP_SLEEP:
+			SVF_REPLAY_NEED(4);
+			if (!dry)
+				svf_queue_sleep(le_to_h_u32(data + pos));
+			pos += 4;
+			break;
+		case SVF_OP_RESET:
+			SVF_REPLAY_NEED(2);
+			if (!dry)
+				svf_queue_reset(data[pos], data[pos + 1]);
+			pos += 2;
+			break;
+		case SVF_OP_FREQUENCY:
+			SVF_REPLAY_NEED(4);
+			if (!dry)
+				command_run_linef(cmd_ctx, "adapter_khz %d",
+						(int)le_to_h_u32(data + pos));
+			pos += 4;
+			break;
+		case SVF_OP_FLUSH:
+			if (!dry && (ERROR_OK != svf_execute_tap()))
+				return ERROR_FAIL;
+			break;
+		default:
+			goto corrupt;
+		}
+	}
+
+corrupt:
+	LOG_ERROR("svf cache is corrupted at offset %zu", pos);
+	return ERROR_FAIL;
+#undef SVF_REPLAY_NEED
+#undef SVF_REPLAY_STATE_MAX
+}
+
 COMMAND_HANDLER(handle_svf_command)
 {
 #define SVF_MIN_NUM_OF_OPTIONS			1
-#define SVF_MAX_NUM_OF_OPTIONS			5
+#define SVF_MAX_NUM_OF_OPTIONS			7
 	int command_num = 0;
 	int ret = ERROR_OK;
 	long long time_measure_ms;
 	int time_measure_s, time_measure_m;
+	const char *cache_dir = NULL;
+	char *cache_path = NULL;
+	uint8_t *cache = NULL;
+	size_t cache_len = 0;
+	uint64_t cache_key;
 
 	/* use NULL to indicate a "plain" svf file which accounts for
 	   any additional devices in the scan chain, otherwise the device
@@ -366,6 +805,12 @@ COMMAND_HANDLER(handle_svf_command)
 		{
 			svf_progress_enabled = 1;
 		}
+		else if ((strcmp(CMD_ARGV[i], "cache") == 0) || (strcmp(CMD_ARGV[i], "-cache") == 0))
+		{
+			if (++i >= CMD_ARGC)
+				return ERROR_COMMAND_SYNTAX_ERROR;
+			cache_dir = CMD_ARGV[i];
+		}
 		else if ((svf_fd = fopen(CMD_ARGV[i], "r")) == NULL)
 		{
 			int err = errno;
@@ -390,8 +835,12 @@ COMMAND_HANDLER(handle_svf_command)
 	// init
 	svf_line_number = 1;
 	svf_command_buffer_size = 0;
+	svf_read_buffer_pos = 0;
+	svf_read_buffer_len = 0;
 
+	svf_check_tdo_para_head = 0;
 	svf_check_tdo_para_index = 0;
+	svf_check_tdo_error = ERROR_OK;
 	svf_check_tdo_para = malloc(sizeof(struct svf_check_tdo_para) * SVF_CHECK_TDO_PARA_SIZE);
 	if (NULL == svf_check_tdo_para)
 	{
@@ -399,6 +848,7 @@ COMMAND_HANDLER(handle_svf_command)
 		ret = ERROR_FAIL;
 		goto free_all;
 	}
+	svf_check_tdo_para_size = SVF_CHECK_TDO_PARA_SIZE;
 
 	svf_buffer_index = 0;
 	// double the buffer size
@@ -489,51 +939,105 @@ COMMAND_HANDLER(handle_svf_command)
 
 	}
 
-	if (svf_progress_enabled)
+	if (cache_dir && svf_nil)
 	{
-		// Count total lines in file.
-		while ( ! feof (svf_fd) )
-		 {
-		   svf_getline (&svf_command_buffer, &svf_command_buffer_size, svf_fd);
-		   svf_total_lines++;
-		 }
-		rewind(svf_fd);
+		LOG_WARNING("svf cache is not used for nil runs");
 	}
-	while (ERROR_OK == svf_read_command_from_file(svf_fd))
+	else if (cache_dir)
 	{
-		// Log Output
-		if (svf_quiet)
+		if (ERROR_OK != svf_cache_key(svf_fd, &cache_key))
 		{
-			if (svf_progress_enabled)
-			{
-				svf_percentage = ((svf_line_number * 20) / svf_total_lines) * 5;
-				if (svf_last_printed_percentage != svf_percentage)
-				{
-					LOG_USER_N("\r%d%%    ", svf_percentage);
-					svf_last_printed_percentage = svf_percentage;
-				}
-			}
+			ret = ERROR_FAIL;
+			goto free_all;
+		}
+		cache_path = alloc_printf("%s/%08" PRIx32 "%08" PRIx32 ".svfc", cache_dir,
+				(uint32_t)(cache_key >> 32), (uint32_t)cache_key);
+		if (cache_path == NULL)
+		{
+			LOG_ERROR("not enough memory");
+			ret = ERROR_FAIL;
+			goto free_all;
+		}
+
+		cache = svf_cache_load(cache_path, cache_key, &cache_len);
+		if (cache && (ERROR_OK != svf_replay(CMD_CTX, cache, cache_len, true, &command_num)))
+		{
+			free(cache);
+			cache = NULL;
 		}
+
+		if (cache)
+			LOG_USER("replaying compiled svf file \"%s\"", cache_path);
 		else
 		{
-			if (svf_progress_enabled)
+			/* compile while running the text, saved if all goes well */
+			svf_compile_size = 64 * 1024;
+			svf_compile_buffer = malloc(svf_compile_size);
+			svf_compile_len = 0;
+			svf_compile(SVF_CACHE_MAGIC, 8);
+			svf_compile_u32((uint32_t)cache_key);
+			svf_compile_u32((uint32_t)(cache_key >> 32));
+		}
+	}
+
+	if (cache)
+	{
+		if (ERROR_OK != svf_replay(CMD_CTX, cache, cache_len, false, &command_num))
+		{
+			LOG_ERROR("fail to replay compiled svf file");
+			ret = ERROR_FAIL;
+		}
+	}
+	else
+	{
+		if (svf_progress_enabled)
+		{
+			// Count total lines in file. feof() is set as soon as the last
+			// block is buffered, so loop on what svf_getline() returns. The
+			// trailing line, terminated or not, is counted like before.
+			while (svf_getline (&svf_command_buffer, &svf_command_buffer_size, svf_fd) > 0)
+				svf_total_lines++;
+			svf_total_lines++;
+			rewind(svf_fd);
+			svf_read_buffer_pos = 0;
+			svf_read_buffer_len = 0;
+		}
+		while (ERROR_OK == svf_read_command_from_file(svf_fd))
+		{
+			// Log Output
+			if (svf_quiet)
 			{
-				svf_percentage = ((svf_line_number * 20) / svf_total_lines) * 5;
-				LOG_USER_N("%3d%%  %s", svf_percentage, svf_read_line);
+				if (svf_progress_enabled)
+				{
+					svf_percentage = ((svf_line_number * 20) / svf_total_lines) * 5;
+					if (svf_last_printed_percentage != svf_percentage)
+					{
+						LOG_USER_N("\r%d%%    ", svf_percentage);
+						svf_last_printed_percentage = svf_percentage;
+					}
+				}
 			}
 			else
 			{
-				LOG_USER_N("%s",svf_read_line);
+				if (svf_progress_enabled)
+				{
+					svf_percentage = ((svf_line_number * 20) / svf_total_lines) * 5;
+					LOG_USER_N("%3d%%  %s", svf_percentage, svf_read_line);
+				}
+				else
+				{
+					LOG_USER_N("%s",svf_read_line);
+				}
+			}
+				// Run Command
+			if (ERROR_OK != svf_run_command(CMD_CTX, svf_command_buffer))
+			{
+				LOG_ERROR("fail to run command at line %d", svf_line_number);
+				ret = ERROR_FAIL;
+				break;
 			}
+			command_num++;
 		}
-			// Run Command
-		if (ERROR_OK != svf_run_command(CMD_CTX, svf_command_buffer))
-		{
-			LOG_ERROR("fail to run command at line %d", svf_line_number);
-			ret = ERROR_FAIL;
-			break;
-		}
-		command_num++;
 	}
 
 	if ((!svf_nil) && (ERROR_OK != jtag_execute_queue()))
@@ -545,6 +1049,14 @@ COMMAND_HANDLER(handle_svf_command)
 		ret = ERROR_FAIL;
 	}
 
+	if (svf_compile_buffer && (ERROR_OK == ret))
+	{
+		svf_compile_u8(SVF_OP_END);
+		svf_compile_u32(command_num);
+		if (svf_compile_buffer)
+			svf_cache_save(cache_path);
+	}
+
 	// print time
 	time_measure_ms = timeval_ms() - time_measure_ms;
 	time_measure_s = time_measure_ms / 1000;
@@ -562,6 +1074,22 @@ free_all:
 	svf_fd = 0;
 
 	// free buffers
+	free(cache);
+	free(cache_path);
+	if (svf_compile_buffer)
+	{
+		free(svf_compile_buffer);
+		svf_compile_buffer = NULL;
+		svf_compile_len = 0;
+		svf_compile_size = 0;
+	}
+	if (svf_read_buffer)
+	{
+		free(svf_read_buffer);
+		svf_read_buffer = NULL;
+		svf_read_buffer_pos = 0;
+		svf_read_buffer_len = 0;
+	}
 	if (svf_command_buffer)
 	{
 		free(svf_command_buffer);
@@ -572,6 +1100,8 @@ free_all:
 	{
 		free(svf_check_tdo_para);
 		svf_check_tdo_para = NULL;
+		svf_check_tdo_para_size = 0;
+		svf_check_tdo_para_head = 0;
 		svf_check_tdo_para_index = 0;
 	}
 	if (svf_tdi_buffer)
@@ -613,38 +1143,61 @@ free_all:
 
 static int svf_getline (char **lineptr, size_t *n, FILE *stream)
 {
-#define MIN_CHUNK 16	//Buffer is increased by this size each time as required
-  size_t i = 0;
-
-  if (*lineptr == NULL)
-    {
-      *n = MIN_CHUNK;
-      *lineptr = (char *)malloc (*n);
-      if (!*lineptr)
-        {
-		  return -1;
-        }
-    }
-
-	(*lineptr)[0] = fgetc(stream);
-	while ((*lineptr)[i] != '\n')
+#define MIN_CHUNK 128	//Initial buffer size, doubled each time as required
+	size_t i = 0, chunk, size;
+	char *line, *nl;
+
+	if (svf_read_buffer == NULL)
 	{
-		(*lineptr)[++i] = fgetc(stream);
-		if (feof(stream))
-		{
-			(*lineptr)[0] = 0;
+		svf_read_buffer = malloc(SVF_READ_BUFFER_SIZE);
+		if (svf_read_buffer == NULL)
 			return -1;
+	}
+
+	for (;;)
+	{
+		if (svf_read_buffer_pos == svf_read_buffer_len)
+		{
+			svf_read_buffer_pos = 0;
+			svf_read_buffer_len = fread(svf_read_buffer, 1, SVF_READ_BUFFER_SIZE, stream);
+			if (svf_read_buffer_len == 0)
+			{
+				/* a last line without '\n' doesn't count */
+				if (*lineptr)
+					(*lineptr)[0] = 0;
+				return -1;
+			}
 		}
-		if ((i + 2) > *n)
+
+		nl = memchr(svf_read_buffer + svf_read_buffer_pos, '\n',
+				svf_read_buffer_len - svf_read_buffer_pos);
+		if (nl)
+			chunk = nl + 1 - (svf_read_buffer + svf_read_buffer_pos);
+		else
+			chunk = svf_read_buffer_len - svf_read_buffer_pos;
+
+		if ((*lineptr == NULL) || ((i + chunk + 1) > *n))
 		{
-			*n += MIN_CHUNK;
-			*lineptr = realloc(*lineptr, *n);
+			size = (*lineptr && *n) ? *n : MIN_CHUNK;
+			while (size < (i + chunk + 1))
+				size *= 2;
+			line = realloc(*lineptr, size);
+			if (line == NULL)
+				return -1;
+			*lineptr = line;
+			*n = size;
 		}
-	}
 
-	(*lineptr)[++i] = 0;
+		memcpy(*lineptr + i, svf_read_buffer + svf_read_buffer_pos, chunk);
+		svf_read_buffer_pos += chunk;
+		i += chunk;
 
-	return sizeof(*lineptr);
+		if (nl)
+		{
+			(*lineptr)[i] = 0;
+			return i;
+		}
+	}
 }
 
 #define SVFP_CMD_INC_CNT			1024
@@ -715,14 +1268,20 @@ static int svf_read_command_from_file(FILE * fd)
 			 *  - added space.
 			 *  - terminating NUL ('\0')
 			 */
-			if ((cmd_pos + 2) >= svf_command_buffer_size)
+			if ((cmd_pos + 3) > svf_command_buffer_size)
 			{
-				svf_command_buffer = realloc(svf_command_buffer, (cmd_pos + 2));
-				if (svf_command_buffer == NULL)
+				size_t size = svf_command_buffer_size;
+				char *buffer;
+
+				size = size ? (2 * size) : SVFP_CMD_INC_CNT;
+				buffer = realloc(svf_command_buffer, size);
+				if (buffer == NULL)
 				{
 					LOG_ERROR("not enough memory");
 					return ERROR_FAIL;
 				}
+				svf_command_buffer = buffer;
+				svf_command_buffer_size = size;
 			}
 
 			/* insert a space before '(' */
@@ -845,6 +1404,21 @@ static int svf_set_padding(struct svf_xxr_para *para, int len, unsigned char tdi
 	return error;
 }
 
+/* Character classes for svf_copy_hexstring_to_binary(): hex digits map to
+ * their value plus one, whitespace to SVF_HEX_SPACE, anything else to 0.
+ * Command strings are upper case by now.
+ */
+#define SVF_HEX_SPACE	0x20
+static const uint8_t svf_hex_char[256] =
+{
+	['0'] = 0x1, ['1'] = 0x2, ['2'] = 0x3, ['3'] = 0x4,
+	['4'] = 0x5, ['5'] = 0x6, ['6'] = 0x7, ['7'] = 0x8,
+	['8'] = 0x9, ['9'] = 0xA, ['A'] = 0xB, ['B'] = 0xC,
+	['C'] = 0xD, ['D'] = 0xE, ['E'] = 0xF, ['F'] = 0x10,
+	[' '] = SVF_HEX_SPACE, ['\t'] = SVF_HEX_SPACE, ['\n'] = SVF_HEX_SPACE,
+	['\v'] = SVF_HEX_SPACE, ['\f'] = SVF_HEX_SPACE, ['\r'] = SVF_HEX_SPACE,
+};
+
 static int svf_copy_hexstring_to_binary(char *str, uint8_t **bin, int orig_bit_len, int bit_len)
 {
 	int i, str_len = strlen(str), str_hbyte_len = (bit_len + 3) >> 2;
@@ -870,23 +1444,16 @@ static int svf_copy_hexstring_to_binary(char *str, uint8_t **bin, int orig_bit_l
 			 * require line ends for correctness, since there is
 			 * a hard limit on line length.
 			 */
-			if (!isspace(ch))
+			ch = svf_hex_char[ch];
+			if (ch != SVF_HEX_SPACE)
 			{
-				if ((ch >= '0') && (ch <= '9'))
-				{
-					ch = ch - '0';
-					break;
-				}
-				else if ((ch >= 'A') && (ch <= 'F'))
-				{
-					ch = ch - 'A' + 10;
-					break;
-				}
-				else
+				if (ch == 0)
 				{
 					LOG_ERROR("invalid hex string");
 					return ERROR_FAIL;
 				}
+				ch--;
+				break;
 			}
 
 			ch = 0;
@@ -921,50 +1488,94 @@ static int svf_copy_hexstring_to_binary(char *str, uint8_t **bin, int orig_bit_l
 	return ERROR_OK;
 }
 
-static int svf_check_tdo(void)
+/* queue callback behind each checked scan; runs once its TDO is in */
+static int svf_check_tdo_callback(jtag_callback_data_t data0, jtag_callback_data_t data1,
+		jtag_callback_data_t data2, jtag_callback_data_t data3)
 {
-	int i, len, index_var;
+	uint8_t *captured = (uint8_t *)data0;
+	struct svf_check_tdo_para *para;
+	int index_var, len;
 
-	for (i = 0; i < svf_check_tdo_para_index; i++)
+	if (svf_check_tdo_para_index == 0)
 	{
-		index_var = svf_check_tdo_para[i].buffer_offset;
-		len = svf_check_tdo_para[i].bit_len;
-		if ((svf_check_tdo_para[i].enabled)
-			&& buf_cmp_mask(&svf_tdi_buffer[index_var], &svf_tdo_buffer[index_var], &svf_mask_buffer[index_var], len))
-		{
-			unsigned bitmask;
-			unsigned received, expected, tapmask;
-			bitmask = svf_get_mask_u32(svf_check_tdo_para[i].bit_len);
-
-			memcpy(&received, svf_tdi_buffer + index_var, sizeof(unsigned));
-			memcpy(&expected, svf_tdo_buffer + index_var, sizeof(unsigned));
-			memcpy(&tapmask, svf_mask_buffer + index_var, sizeof(unsigned));
-			LOG_ERROR("tdo check error at line %d",
-					  svf_check_tdo_para[i].line_num);
-			LOG_ERROR("read = 0x%X, want = 0x%X, mask = 0x%X",
-					  received & bitmask,
-					  expected & bitmask,
-					  tapmask & bitmask);
-			return ERROR_FAIL;
-		}
+		LOG_ERROR("tdo check without pending check parameters");
+		return ERROR_FAIL;
+	}
+
+	para = &svf_check_tdo_para[svf_check_tdo_para_head];
+	svf_check_tdo_para_head = (svf_check_tdo_para_head + 1) % svf_check_tdo_para_size;
+	svf_check_tdo_para_index--;
+
+	index_var = para->buffer_offset;
+	len = para->bit_len;
+	if (buf_cmp_mask(captured, &svf_tdo_buffer[index_var], &svf_mask_buffer[index_var], len))
+	{
+		unsigned bitmask;
+		unsigned received, expected, tapmask;
+		bitmask = svf_get_mask_u32(len);
+
+		memcpy(&received, captured, sizeof(unsigned));
+		memcpy(&expected, svf_tdo_buffer + index_var, sizeof(unsigned));
+		memcpy(&tapmask, svf_mask_buffer + index_var, sizeof(unsigned));
+		LOG_ERROR("tdo check error at line %d",
+				  para->line_num);
+		LOG_ERROR("read = 0x%X, want = 0x%X, mask = 0x%X",
+				  received & bitmask,
+				  expected & bitmask,
+				  tapmask & bitmask);
+		svf_check_tdo_error = ERROR_FAIL;
+		return ERROR_FAIL;
 	}
-	svf_check_tdo_para_index = 0;
 
 	return ERROR_OK;
 }
 
+/* after a flush:  the callbacks did the comparing, report their verdict and
+ * drop checks whose data never came back (-nil, or an aborted queue)
+ */
+static int svf_check_tdo(void)
+{
+	int retval = svf_check_tdo_error;
+
+	svf_check_tdo_para_head = 0;
+	svf_check_tdo_para_index = 0;
+	svf_check_tdo_error = ERROR_OK;
+
+	return retval;
+}
+
 static int svf_add_check_para(uint8_t enabled, int buffer_offset, int bit_len)
 {
-	if (svf_check_tdo_para_index >= SVF_CHECK_TDO_PARA_SIZE)
+	struct svf_check_tdo_para *para;
+
+	if (!enabled)
+		return ERROR_OK;
+
+	if (svf_check_tdo_para_index >= svf_check_tdo_para_size)
 	{
-		LOG_ERROR("toooooo many operation undone");
-		return ERROR_FAIL;
+		int size = 2 * svf_check_tdo_para_size;
+		int i;
+
+		para = malloc(sizeof(struct svf_check_tdo_para) * size);
+		if (NULL == para)
+		{
+			LOG_ERROR("not enough memory");
+			return ERROR_FAIL;
+		}
+		// unwrap the pending checks to the start of the new ring
+		for (i = 0; i < svf_check_tdo_para_index; i++)
+			para[i] = svf_check_tdo_para[(svf_check_tdo_para_head + i) % svf_check_tdo_para_size];
+		free(svf_check_tdo_para);
+		svf_check_tdo_para = para;
+		svf_check_tdo_para_size = size;
+		svf_check_tdo_para_head = 0;
 	}
 
-	svf_check_tdo_para[svf_check_tdo_para_index].line_num = svf_line_number;
-	svf_check_tdo_para[svf_check_tdo_para_index].bit_len = bit_len;
-	svf_check_tdo_para[svf_check_tdo_para_index].enabled = enabled;
-	svf_check_tdo_para[svf_check_tdo_para_index].buffer_offset = buffer_offset;
+	para = &svf_check_tdo_para[(svf_check_tdo_para_head + svf_check_tdo_para_index) % svf_check_tdo_para_size];
+	para->line_num = svf_line_number;
+	para->bit_len = bit_len;
+	para->enabled = enabled;
+	para->buffer_offset = buffer_offset;
 	svf_check_tdo_para_index++;
 
 	return ERROR_OK;
@@ -972,6 +1583,8 @@ static int svf_add_check_para(uint8_t enabled, int buffer_offset, int bit_len)
 
 static int svf_execute_tap(void)
 {
+	svf_compile_u8(SVF_OP_FLUSH);
+
 	if ((!svf_nil) && (ERROR_OK != jtag_execute_queue()))
 	{
 		return ERROR_FAIL;
@@ -1000,7 +1613,6 @@ static int svf_run_command(struct command_context *cmd_ctx, char *cmd_str)
 	// for XXR
 	struct svf_xxr_para *xxr_para_tmp;
 	uint8_t **pbuffer_tmp;
-	struct scan_field field;
 	// for STATE
 	tap_state_t *path = NULL, state;
 	// flag padding commands skipped due to -tap command
@@ -1077,6 +1689,8 @@ static int svf_run_command(struct command_context *cmd_ctx, char *cmd_str)
 			// TODO: set jtag speed to
 			if (svf_para.frequency > 0)
 			{
+				svf_compile_u8(SVF_OP_FREQUENCY);
+				svf_compile_u32((int)svf_para.frequency / 1000);
 				command_run_linef(cmd_ctx, "adapter_khz %d", (int)svf_para.frequency / 1000);
 				LOG_DEBUG("\tfrequency = %f", svf_para.frequency);
 			}
@@ -1297,14 +1911,8 @@ static int svf_run_command(struct command_context *cmd_ctx, char *cmd_str)
 			{
 				svf_add_check_para(0, svf_buffer_index, i);
 			}
-			field.num_bits = i;
-			field.out_value = &svf_tdi_buffer[svf_buffer_index];
-			field.in_value = &svf_tdi_buffer[svf_buffer_index];
-			if (!svf_nil)
-			{
-				/* NOTE:  doesn't use SVF-specified state paths */
-				jtag_add_plain_dr_scan(field.num_bits, field.out_value, field.in_value, svf_para.dr_end_state);
-			}
+			svf_queue_scan(false, i, svf_para.sdr_para.data_mask & XXR_TDO,
+					svf_para.dr_end_state);
 
 			svf_buffer_index += (i + 7) >> 3;
 		}
@@ -1395,15 +2003,8 @@ static int svf_run_command(struct command_context *cmd_ctx, char *cmd_str)
 			{
 				svf_add_check_para(0, svf_buffer_index, i);
 			}
-			field.num_bits = i;
-			field.out_value = &svf_tdi_buffer[svf_buffer_index];
-			field.in_value = &svf_tdi_buffer[svf_buffer_index];
-			if (!svf_nil)
-			{
-				/* NOTE:  doesn't use SVF-specified state paths */
-				jtag_add_plain_ir_scan(field.num_bits, field.out_value, field.in_value,
-						svf_para.ir_end_state);
-			}
+			svf_queue_scan(true, i, svf_para.sir_para.data_mask & XXR_TDO,
+					svf_para.ir_end_state);
 
 			svf_buffer_index += (i + 7) >> 3;
 		}
@@ -1515,15 +2116,11 @@ static int svf_run_command(struct command_context *cmd_ctx, char *cmd_str)
 			}
 
 			// add clocks and/or min wait
-			if (run_count > 0) {
-				if (!svf_nil)
-					jtag_add_clocks(run_count);
-			}
+			if (run_count > 0)
+				svf_queue_clocks(run_count);
 
-			if (min_usec > 0) {
-				if (!svf_nil)
-					jtag_add_sleep(min_usec);
-			}
+			if (min_usec > 0)
+				svf_queue_sleep(min_usec);
 
 			// move to end_state if necessary
 			if (svf_para.runtest_end_state != svf_para.runtest_run_state)
@@ -1581,12 +2178,8 @@ static int svf_run_command(struct command_context *cmd_ctx, char *cmd_str)
 				{
 					/* FIXME last state MUST be stable! */
 					if (i > 0)
-					{
-						if (!svf_nil)
-							jtag_add_pathmove(i, path);
-					}
-					if (!svf_nil)
-						jtag_add_tlr();
+						svf_queue_pathmove(i, path);
+					svf_queue_tlr();
 					num_of_argu -= i + 1;
 					i = -1;
 				}
@@ -1597,8 +2190,7 @@ static int svf_run_command(struct command_context *cmd_ctx, char *cmd_str)
 				if (svf_tap_state_is_stable(path[num_of_argu - 1]))
 				{
 					// last state MUST be stable state
-					if (!svf_nil)
-						jtag_add_pathmove(num_of_argu, path);
+					svf_queue_pathmove(num_of_argu, path);
 					LOG_DEBUG("\tmove to %s by path_move",
 						tap_state_name(path[num_of_argu - 1]));
 				}
@@ -1653,13 +2245,11 @@ static int svf_run_command(struct command_context *cmd_ctx, char *cmd_str)
 			switch (i_tmp)
 			{
 			case TRST_ON:
-				if (!svf_nil)
-					jtag_add_reset(1, 0);
+				svf_queue_reset(1, 0);
 				break;
 			case TRST_Z:
 			case TRST_OFF:
-				if (!svf_nil)
-					jtag_add_reset(0, 0);
+				svf_queue_reset(0, 0);
 				break;
 			case TRST_ABSENT:
 				break;
@@ -1708,7 +2298,7 @@ static int svf_run_command(struct command_context *cmd_ctx, char *cmd_str)
 				int read_value;
 				memcpy(&read_value, svf_tdi_buffer, sizeof(int));
 				// in debug mode, data is from index 0
-				int read_mask = svf_get_mask_u32(svf_check_tdo_para[0].bit_len);
+				int read_mask = svf_get_mask_u32(svf_last_scan_len);
 				LOG_DEBUG("\tTDO read = 0x%X", read_value & read_mask);
 			}
 		}
@@ -1717,7 +2307,7 @@ static int svf_run_command(struct command_context *cmd_ctx, char *cmd_str)
 	{
 		// for fast executing, execute tap if necessary
 		// half of the buffer is for the next command
-		if (((svf_buffer_index >= SVF_MAX_BUFFER_SIZE_TO_COMMIT) || (svf_check_tdo_para_index >= SVF_CHECK_TDO_PARA_SIZE / 2)) && \
+		if ((svf_buffer_index >= SVF_MAX_BUFFER_SIZE_TO_COMMIT) && \
 			(((command != STATE) && (command != RUNTEST)) || \
 			((command == STATE) && (num_of_argu == 2))))
 		{
@@ -1734,7 +2324,7 @@ static const struct command_registration svf_command_handlers[] = {
 		.handler = handle_svf_command,
 		.mode = COMMAND_EXEC,
 		.help = "Runs a SVF file.",
-		.usage = "svf [-tap device.tap] <file> [quiet] [nil] [progress]",
+		.usage = "svf [-tap device.tap] <file> [quiet] [nil] [progress] [cache <dir>]",
 	},
 	COMMAND_REGISTRATION_DONE
 };
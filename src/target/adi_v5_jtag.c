@@ -446,6 +446,7 @@ const struct dap_ops jtag_dp_ops = {
 	.queue_ap_write =	jtag_ap_q_write,
 	.queue_ap_abort =	jtag_ap_q_abort,
 	.run =			jtag_dp_run,
+	.mem_ap_read_buf_u32 =	mem_ap_read_buf_u32_jtag,
 };
 
 
@@ -125,6 +125,7 @@ const struct dap_ops swd_dap_ops = {
 	.queue_ap_write = swd_queue_ap_write,
 	.queue_ap_abort = swd_queue_ap_abort,
 	.run = swd_run,
+	.mem_ap_read_buf_u32 = mem_ap_read_buf_u32_swd,
 };
 
 /*
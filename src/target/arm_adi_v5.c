@@ -279,7 +279,8 @@ int mem_ap_write_atomic_u32(struct adiv5_dap *dap, uint32_t address,
 * Write a buffer in target order (little endian)                             *
 *                                                                            *
 *****************************************************************************/
-int mem_ap_write_buf_u32(struct adiv5_dap *dap, const uint8_t *buffer, int count, uint32_t address)
+static int mem_ap_write_buf_u32_queued(struct adiv5_dap *dap,
+		const uint8_t *buffer, int count, uint32_t address)
 {
 	int wcount, blocksize, writecount, errorcount = 0, retval = ERROR_OK;
 	uint32_t adr = address;
@@ -351,6 +352,20 @@ int mem_ap_write_buf_u32(struct adiv5_dap *dap, const uint8_t *buffer, int count
 	return retval;
 }
 
+/**
+ * Synchronously write a block of 32-bit words from a buffer in target
+ * order.  Transports or adapters able to move whole blocks themselves
+ * provide dap_ops.mem_ap_write_buf_u32; everything else goes through
+ * the generic DRW loop, which only needs the queue primitives.
+ */
+int mem_ap_write_buf_u32(struct adiv5_dap *dap, const uint8_t *buffer, int count, uint32_t address)
+{
+	assert(dap->ops != NULL);
+	if (dap->ops->mem_ap_write_buf_u32)
+		return dap->ops->mem_ap_write_buf_u32(dap, buffer, count, address);
+	return mem_ap_write_buf_u32_queued(dap, buffer, count, address);
+}
+
 static int mem_ap_write_buf_packed_u16(struct adiv5_dap *dap,
 		const uint8_t *buffer, int count, uint32_t address)
 {
@@ -689,8 +704,177 @@ int mem_ap_read_buf_u32_jtag(struct adiv5_dap *dap, uint8_t *buffer,
 }
 
 
+/***************************************************************************
+ *                                                                         *
+ * Adaptive WAIT handling                                                  *
+ *                                                                         *
+***************************************************************************/
+
+/* Idle cycles never grow past this, same range as "dap memaccess" */
+#define DAP_WAIT_IDLE_MAX		255
+/* Clean runs needed before idle cycles are trimmed again */
+#define DAP_WAIT_DECAY_RUNS		32
+/* Attempts at a transfer that keeps running into WAIT */
+#define DAP_WAIT_RETRIES		10
+/* First backoff delay; it doubles with each attempt up to the maximum */
+#define DAP_WAIT_BACKOFF_US		10
+#define DAP_WAIT_BACKOFF_MAX_US	10000
+
+/**
+ * Get WAIT handling state of the currently selected AP, allocating the
+ * table on first use.
+ * @return pointer to the state, or NULL on allocation failure.
+ */
+struct adiv5_ap_wait *dap_ap_wait(struct adiv5_dap *dap)
+{
+	if (dap->ap_wait == NULL)
+	{
+		dap->ap_wait = calloc(256, sizeof(struct adiv5_ap_wait));
+		if (dap->ap_wait == NULL)
+		{
+			LOG_ERROR("out of memory");
+			return NULL;
+		}
+	}
+	return dap->ap_wait + dap_ap_get_select(dap);
+}
+
+/**
+ * Account one run() outcome against the currently selected AP.
+ *
+ * Each WAIT roughly doubles the idle cycles inserted after transfers to
+ * the AP, while every DAP_WAIT_DECAY_RUNS runs without WAIT trim them by
+ * an eighth.  The count thus settles just above what the AP needs: a
+ * loaded or slow-clocked bus stops producing WAITs (and the retransmits
+ * they cost), and a fast one is not slowed down by idle clocks it does
+ * not need.
+ *
+ * @param dap The DAP whose run() just completed.
+ * @param retval What run() returned.
+ */
+void dap_wait_account(struct adiv5_dap *dap, int retval)
+{
+	struct adiv5_ap_wait *wait;
+
+	if (dap->ap_wait_recovery)
+		return;
+
+	wait = dap_ap_wait(dap);
+	if (wait == NULL)
+		return;
+
+	wait->runs++;
+	switch (retval)
+	{
+	case ERROR_DAP_WAIT:
+		wait->waits++;
+		wait->clean_runs = 0;
+		wait->idle_cycles = MIN(2 * wait->idle_cycles + 1, DAP_WAIT_IDLE_MAX);
+		LOG_DEBUG("AP %d WAIT, now %" PRIu32 " idle cycles",
+				dap_ap_get_select(dap), wait->idle_cycles);
+		break;
+	case ERROR_DAP_FAULT:
+		wait->faults++;
+		wait->clean_runs = 0;
+		break;
+	case ERROR_OK:
+		if (wait->idle_cycles == 0)
+			break;
+		if (++wait->clean_runs < DAP_WAIT_DECAY_RUNS)
+			break;
+		wait->clean_runs = 0;
+		wait->idle_cycles -= wait->idle_cycles / 8 + 1;
+		break;
+	default:
+		break;
+	}
+}
+
+/**
+ * Get ready to retry a transfer after its run ended in WAIT or FAULT:
+ * back off for a delay that doubles with each attempt, clear the sticky
+ * error flags and forget the cached CSW/TAR, whose writes may not have
+ * reached the AP.  SWD only, JTAG-DP has no ABORT at this address.
+ *
+ * @param dap The DAP to recover.
+ * @param attempt How many times the transfer has been retried so far.
+ * @return ERROR_OK when the DAP is ready for another attempt.
+ */
+static int dap_wait_backoff(struct adiv5_dap *dap, int attempt)
+{
+	struct adiv5_ap_wait *wait = dap_ap_wait(dap);
+	int retval;
+
+	if (wait != NULL)
+		wait->retries++;
+
+	jtag_sleep(MIN(DAP_WAIT_BACKOFF_US << attempt, DAP_WAIT_BACKOFF_MAX_US));
+
+	dap->ap_csw_value = -1;
+	dap->ap_tar_value = -1;
+
+	/* The ABORT write is not an AP transfer, keep it out of the statistics. */
+	dap->ap_wait_recovery = true;
+	retval = dap_queue_dp_write(dap, DP_ABORT,
+			STKCMPCLR | STKERRCLR | WDERRCLR | ORUNERRCLR);
+	if (retval == ERROR_OK)
+		retval = dap_run(dap);
+	dap->ap_wait_recovery = false;
+	if (retval != ERROR_OK)
+		LOG_ERROR("Cannot clear sticky errors with ABORT write");
+	return retval;
+}
+
+/**
+ * Read a single word over SWD the slow way: AP setup, DRW read and a
+ * CTRL/STAT check for READOK in one run, backing off and retrying while
+ * the AP answers WAIT.  This is the recovery path for
+ * mem_ap_read_buf_u32_swd() once a pipelined block has failed.
+ */
+static int mem_ap_read_u32_swd_recover(struct adiv5_dap *dap,
+		uint32_t address, uint32_t *value)
+{
+	int retval = ERROR_OK;
+	uint32_t ctrlstatval;
+	int attempt;
+
+	for (attempt = 0; attempt < DAP_WAIT_RETRIES; attempt++)
+	{
+		retval = dap_wait_backoff(dap, attempt);
+		if (retval != ERROR_OK)
+			continue;
+
+		retval = dap_setup_accessport(dap, CSW_32BIT, address);
+		if (retval == ERROR_OK)
+			retval = dap_queue_ap_read(dap, AP_REG_DRW, value);
+		/* AP read is posted, transport delivers the result from RDBUFF on dap_run(). */
+		if (retval == ERROR_OK)
+			retval = dap_queue_dp_read(dap, DP_CTRL_STAT, &ctrlstatval);
+		if (retval == ERROR_OK)
+			retval = dap_run(dap);
+		if (retval == ERROR_OK)
+		{
+			if (ctrlstatval & READOK)
+				return ERROR_OK;
+			retval = ERROR_FAIL;
+		}
+		else if (retval != ERROR_DAP_WAIT)
+			break;
+	}
+
+	LOG_ERROR("MEM-AP read of 0x%8.8" PRIx32 " failed", address);
+	return retval;
+}
+
 /**
  * Synchronously read a block of 32-bit words into a buffer using SWD.
+ *
+ * Words are read in runs that stay within the TAR autoincrement block:
+ * one CSW/TAR setup, back to back posted DRW reads and a single RDBUFF
+ * read closing the run, all in one dap_run().  A run that ends in WAIT
+ * is retried with backoff, see dap_wait_account(); one that still fails
+ * is redone word by word through mem_ap_read_u32_swd_recover().
+ *
  * @param dap The DAP connected to the MEM-AP.
  * @param buffer where the words will be stored (in host byte order).
  * @param count How many words to read.
@@ -700,104 +884,81 @@ int mem_ap_read_buf_u32_jtag(struct adiv5_dap *dap, uint8_t *buffer,
 int mem_ap_read_buf_u32_swd(struct adiv5_dap *dap, uint8_t *buffer,
 		int count, uint32_t address)
 {
-	int i, readcount,retval = ERROR_OK;
-	uint32_t invalue, adr = address, ctrlstatval;
+	int wcount, blocksize, readcount, attempt, retval = ERROR_OK;
+	uint32_t adr = address;
 	uint8_t* pBuffer = buffer;
+	uint32_t *words;
 
-	int retry, iretry, iiretry;	//TC: dirty check to retry whole access before failing.
-	int maxretry=5; 	//TC: delay will double with each retry.
+	count >>= 2;
+	wcount = count;
 
-	for (retry=maxretry;retry;retry--){
+	words = malloc(sizeof(uint32_t) * MIN(wcount, (int)(dap->tar_autoincr_block >> 2)));
+	if (words == NULL && wcount > 0)
+	{
+		LOG_ERROR("out of memory");
+		return ERROR_FAIL;
+	}
+
+	while (wcount > 0)
+	{
+		blocksize = max_tar_block_size(dap->tar_autoincr_block, address);
+		if (wcount < blocksize)
+			blocksize = wcount;
 
-		while (count > 0)
+		/* handle unaligned data at 4k boundary */
+		if (blocksize == 0)
+			blocksize = 1;
+
+		for (attempt = 0; ; attempt++)
 		{
-			// Setup the AP
-			for (iretry=maxretry;iretry;iretry--){
-				// Auti-Increment may fail at this point so we don't use it here for now!
-				retval = dap_setup_accessport(dap, CSW_32BIT, address);
-				if (retval != ERROR_OK) {
-					LOG_ERROR("AP Setup enqueue failed!");
-					continue;
-				}
+			retval = dap_setup_accessport(dap, CSW_32BIT | CSW_ADDRINC_SINGLE,
+					address);
+			for (readcount = 0; (retval == ERROR_OK) && (readcount < blocksize); readcount++)
+				retval = dap_queue_ap_read(dap, AP_REG_DRW, words + readcount);
+			if (retval == ERROR_OK)
 				retval = dap_run(dap);
-				if (retval != ERROR_OK) {
-					LOG_ERROR("AP Setup queue flush failed!");
-					continue;
-				}
-				// Now as AP is setup we need to read the data.
-				// AP will return WAIT when data not ready, so we need to retry DRW access.
-				// CTRL/STAT{READOK} is set only after ACK=OK so it does not show it AP has finished!!!
-				// According to ARM documentation reading DRW initiates memory access, so
-				//  retrying DRW reads would always produce WAIT. Wrong!
-				// We need to read DRW until ACK=OK, this is practical way to read from AP.
-				// After we get OK, we need to chech READOK flag, then read result from RDATA!!!
-				for (iiretry=maxretry;iiretry;iiretry--){
-					retval = dap_queue_ap_read(dap, AP_REG_DRW, &invalue);
-					if (retval == ERROR_OK) break;
-
-					retval = dap_queue_dp_read(dap, DP_CTRL_STAT, &ctrlstatval);
-					if (retval != ERROR_OK) {
-						LOG_ERROR("Cannot read CTRL/STAT!");
-						continue;
-					}
-					retval = dap_queue_dp_write(dap, DP_ABORT, 0x00000014);
-					if (retval != ERROR_OK){
-						LOG_ERROR("Cannot enqueue ABORT write");
-						continue;
-					}
-					retval = dap_run(dap);
-					if (retval != ERROR_OK) {
-						LOG_ERROR("Cannot flush queued ABORT write");
-						continue;
-					}
-				 }
-				// ARM BUG!? Even that we get ACK=OK we need to read the result from RDBUFF.
-				// RESEND will produce bad value. Data returned after ACK=OK is also bad.
-				if (retval == ERROR_OK) {
-					retval = dap_queue_dp_read(dap, DP_CTRL_STAT, &ctrlstatval);
-					if (ctrlstatval&READOK){
-						dap_queue_dp_read(dap, DP_RDBUFF, &invalue);
-						break;
-					}
-				};
-			}
-			if (!iretry && !iiretry) {
-				LOG_ERROR("MEM-AP READ FAILED, RETRYING...");
+
+			/* WAIT has already raised the idle cycles, so the
+			 * block is likely to go through on the next attempt
+			 */
+			if (retval != ERROR_DAP_WAIT || attempt >= DAP_WAIT_RETRIES)
 				break;
-			}
+			if (dap_wait_backoff(dap, attempt) != ERROR_OK)
+				break;
+		}
 
-			LOG_INFO("COUNT=%d, ADDR=%X, BUFF=%x", count, address, invalue);
-			if (address & 0x3u)
+		if (retval != ERROR_OK)
+		{
+			LOG_DEBUG("block read at 0x%8.8" PRIx32 " failed, retrying word by word",
+					address);
+			for (readcount = 0; readcount < blocksize; readcount++)
 			{
-				for (i = 0; i < 4; i++)
+				retval = mem_ap_read_u32_swd_recover(dap,
+						address + 4 * readcount, words + readcount);
+				if (retval != ERROR_OK)
 				{
-					*((uint8_t*)buffer) = (invalue >> 8 * (address & 0x3));
-					buffer++;
-					address++;
+					free(words);
+					return retval;
 				}
 			}
-			else
-			{
-				uint32_t svalue = (invalue >> 8 * (address & 0x3));
-				memcpy(buffer, &svalue, sizeof(uint32_t));
-				address += 4;
-				buffer += 4;
-			}
-			count -= 4;
-	
 		}
-		if (count<=0) break;
-	}
-	if (!retry){
-		LOG_ERROR("MEM-AP READ FAILED AFTER %d RETRIES...", maxretry);
-		return ERROR_FAIL;
+
+		for (readcount = 0; readcount < blocksize; readcount++)
+			h_u32_to_le(buffer + 4 * readcount, words[readcount]);
+
+		wcount = wcount - blocksize;
+		address += 4 * blocksize;
+		buffer += 4 * blocksize;
 	}
 
-	// if we have an unaligned access - reorder data 
+	free(words);
+
+	/* if we have an unaligned access - reorder data */
 	if (adr & 0x3u)
 	{
 		for (readcount = 0; readcount < count; readcount++)
 		{
+			int i;
 			uint32_t data;
 			memcpy(&data, pBuffer, sizeof(uint32_t));
 
@@ -810,6 +971,7 @@ int mem_ap_read_buf_u32_swd(struct adiv5_dap *dap, uint8_t *buffer,
 			}
 		}
 	}
+
 	return ERROR_OK;
 }
 
@@ -822,16 +984,14 @@ int mem_ap_read_buf_u32_swd(struct adiv5_dap *dap, uint8_t *buffer,
  *	words must be readable by the currently selected MEM-AP.
  */
 int mem_ap_read_buf_u32(struct adiv5_dap *dap, uint8_t *buffer,
-          int count, uint32_t address)
+		int count, uint32_t address)
 {
-     if (strncmp(jtag_interface->transport->name, "swd", 3)==0) {
-		return mem_ap_read_buf_u32_swd(dap, buffer, count, address);
-     } else if (strncmp(jtag_interface->transport->name, "jtag", 4)==0) {
-		return mem_ap_read_buf_u32_jtag(dap, buffer, count, address);
-     } else {
-		LOG_ERROR("unsupported transport!");
-		return ERROR_FAIL;
-	}
+	assert(dap->ops != NULL);
+	if (dap->ops->mem_ap_read_buf_u32)
+		return dap->ops->mem_ap_read_buf_u32(dap, buffer, count, address);
+
+	/* the pipelined SWD version only uses the queue primitives */
+	return mem_ap_read_buf_u32_swd(dap, buffer, count, address);
 }
 
 static int mem_ap_read_buf_packed_u16(struct adiv5_dap *dap,
@@ -1182,7 +1342,7 @@ int ahbap_debugport_init(struct adiv5_dap *dap)
 	//Sticky Flags handling is different for JTAG and SWD.
 	//TODO: Create one function that will take care of error handling based on transport type.
 	//Abort does not clear sticky error flags.
-     if ((strncmp(jtag_interface->transport->name, "swd", 3)==0)) {
+     if (dap->ops->is_swd) {
 		//Clear error flags on SW-DP
 	     retval = dap_queue_dp_write(dap, DP_ABORT, \
 			ORUNERRCLR|WDERRCLR|STKERRCLR|STKCMPCLR);
@@ -1882,6 +2042,45 @@ COMMAND_HANDLER(dap_memaccess_command)
 	return ERROR_OK;
 }
 
+COMMAND_HANDLER(dap_wait_command)
+{
+	struct target *target = get_current_target(CMD_CTX);
+	struct arm *arm = target_to_arm(target);
+	struct adiv5_dap *dap = arm->dap;
+	struct adiv5_ap_wait *wait;
+	unsigned ap;
+
+	switch (CMD_ARGC) {
+	case 0:
+		break;
+	case 1:
+		if (strcmp(CMD_ARGV[0], "reset") != 0)
+			return ERROR_COMMAND_SYNTAX_ERROR;
+		/* keep the learned idle cycles, only restart counting */
+		for (ap = 0; dap->ap_wait && ap < 256; ap++)
+		{
+			wait = dap->ap_wait + ap;
+			wait->runs = wait->waits = wait->faults = wait->retries = 0;
+		}
+		return ERROR_OK;
+	default:
+		return ERROR_COMMAND_SYNTAX_ERROR;
+	}
+
+	for (ap = 0; dap->ap_wait && ap < 256; ap++)
+	{
+		wait = dap->ap_wait + ap;
+		if (wait->runs == 0)
+			continue;
+		command_print(CMD_CTX, "ap %u: %" PRIu32 " runs, %" PRIu32 " WAIT, "
+				"%" PRIu32 " FAULT, %" PRIu32 " retries, %" PRIu32 " idle cycles",
+				ap, wait->runs, wait->waits, wait->faults,
+				wait->retries, wait->idle_cycles);
+	}
+
+	return ERROR_OK;
+}
+
 COMMAND_HANDLER(dap_apsel_command)
 {
 	struct target *target = get_current_target(CMD_CTX);
@@ -1999,6 +2198,14 @@ static const struct command_registration dap_commands[] = {
 			"bus access [0-255]",
 		.usage = "[cycles]",
 	},
+	{
+		.name = "wait",
+		.handler = dap_wait_command,
+		.mode = COMMAND_EXEC,
+		.help = "display per AP WAIT counters and adapted idle "
+			"cycles, or reset the counters",
+		.usage = "['reset']",
+	},
 	COMMAND_REGISTRATION_DONE
 };
 
@@ -45,6 +45,10 @@
 #define SWD_ACK_WAIT	0x2
 #define SWD_ACK_FAULT	0x4
 
+/* run() outcomes a transport can tell apart from plain failures */
+#define ERROR_DAP_WAIT		(-1700)
+#define ERROR_DAP_FAULT		(-1701)
+
 #define DPAP_WRITE		0
 #define DPAP_READ		1
 
@@ -135,6 +139,26 @@
  * as part of setting up a debug session (if all the dual-role JTAG/SWD
  * signals are available).
  */
+struct oocd_swd_queue;
+
+/**
+ * WAIT handling state of one AP.  The transport inserts idle_cycles idle
+ * clocks after each transfer, giving a slow memory bus time to finish
+ * before the next request; see dap_wait_account() for how that adapts.
+ */
+struct adiv5_ap_wait
+{
+	uint32_t idle_cycles;
+	/** Runs without WAIT since idle_cycles last changed. */
+	uint32_t clean_runs;
+
+	/* Counters shown by "dap wait". */
+	uint32_t runs;
+	uint32_t waits;
+	uint32_t faults;
+	uint32_t retries;
+};
+
 struct adiv5_dap
 {
 	const struct dap_ops *ops;
@@ -142,6 +166,14 @@ struct adiv5_dap
 	/** Context to store DAP specific settings and operations. */
 	void *ctx;
 
+	/** SWD transport reads waiting for run() to deliver their results. */
+	struct oocd_swd_queue *swd_queue;
+
+	/** WAIT handling state indexed by AP number, NULL until first use. */
+	struct adiv5_ap_wait *ap_wait;
+	/** Set while recovering from a WAIT, so its own runs aren't accounted. */
+	bool ap_wait_recovery;
+
 	struct arm_jtag *jtag_info;
 	/* Control config */
 	uint32_t dp_ctrl_stat;
@@ -237,6 +269,18 @@ struct dap_ops {
 
 	/** Executes all queued DAP operations. */
 	int (*run)(struct adiv5_dap *dap);
+
+	/**
+	 * MEM-AP block read of 32-bit words, see mem_ap_read_buf_u32().
+	 * Optional; lets a transport, or an adapter that does whole block
+	 * transfers in its firmware, replace the generic DRW loop.  Unlike
+	 * the queue methods this runs synchronously.
+	 */
+	int (*mem_ap_read_buf_u32)(struct adiv5_dap *dap, uint8_t *buffer,
+			int count, uint32_t address);
+	/** MEM-AP block write of 32-bit words, see mem_ap_write_buf_u32(). */
+	int (*mem_ap_write_buf_u32)(struct adiv5_dap *dap,
+			const uint8_t *buffer, int count, uint32_t address);
 };
 
 /**
@@ -369,6 +413,10 @@ static inline uint8_t dap_ap_get_select(struct adiv5_dap *swjdp)
 /* AP selection applies to future AP transactions */
 void dap_ap_select(struct adiv5_dap *dap,uint8_t ap);
 
+/* Adaptive WAIT handling, fed by the transport after each run */
+struct adiv5_ap_wait *dap_ap_wait(struct adiv5_dap *dap);
+void dap_wait_account(struct adiv5_dap *dap, int retval);
+
 /* Queued AP transactions */
 int dap_setup_accessport(struct adiv5_dap *swjdp,
 		uint32_t csw, uint32_t tar);
@@ -398,6 +446,12 @@ int mem_ap_write_buf_u16(struct adiv5_dap *swjdp,
 int mem_ap_write_buf_u32(struct adiv5_dap *swjdp,
 		const uint8_t *buffer, int count, uint32_t address);
 
+/* Transport specific block reads, used as dap_ops.mem_ap_read_buf_u32 */
+int mem_ap_read_buf_u32_jtag(struct adiv5_dap *swjdp,
+		uint8_t *buffer, int count, uint32_t address);
+int mem_ap_read_buf_u32_swd(struct adiv5_dap *swjdp,
+		uint8_t *buffer, int count, uint32_t address);
+
 
 
 /* Queued MEM-AP memory mapped single word transfers with selection of ap */
@@ -38,6 +38,7 @@
 #include "armv7m.h"
 #include "algorithm.h"
 #include "register.h"
+#include "image.h"
 
 
 #if 0
@@ -287,53 +288,45 @@ int armv7m_get_gdb_reg_list(struct target *target, struct reg **reg_list[], int
 	return ERROR_OK;
 }
 
-/* run to exit point. return error if exit point was not reached. */
-static int armv7m_run_and_wait(struct target *target, uint32_t entry_point, int timeout_ms, uint32_t exit_point, struct armv7m_common *armv7m)
+/** Runs a Thumb algorithm in the target. */
+int armv7m_run_algorithm(struct target *target,
+	int num_mem_params, struct mem_param *mem_params,
+	int num_reg_params, struct reg_param *reg_params,
+	uint32_t entry_point, uint32_t exit_point,
+	int timeout_ms, void *arch_info)
 {
-	uint32_t pc;
 	int retval;
-	/* This code relies on the target specific  resume() and  poll()->debug_entry()
-	 * sequence to write register values to the processor and the read them back */
-	if ((retval = target_resume(target, 0, entry_point, 1, 1)) != ERROR_OK)
-	{
-		return retval;
-	}
 
-	retval = target_wait_state(target, TARGET_HALTED, timeout_ms);
-	/* If the target fails to halt due to the breakpoint, force a halt */
-	if (retval != ERROR_OK || target->state != TARGET_HALTED)
-	{
-		if ((retval = target_halt(target)) != ERROR_OK)
-			return retval;
-		if ((retval = target_wait_state(target, TARGET_HALTED, 500)) != ERROR_OK)
-		{
-			return retval;
-		}
-		return ERROR_TARGET_TIMEOUT;
-	}
+	retval = armv7m_start_algorithm(target,
+			num_mem_params, mem_params,
+			num_reg_params, reg_params,
+			entry_point, exit_point,
+			arch_info);
 
-	armv7m->load_core_reg_u32(target, ARMV7M_REGISTER_CORE_GP, 15, &pc);
-	if (exit_point && (pc != exit_point))
-	{
-		LOG_DEBUG("failed algorithm halted at 0x%" PRIx32 " ", pc);
-		return ERROR_TARGET_TIMEOUT;
-	}
+	if (retval == ERROR_OK)
+		retval = armv7m_wait_algorithm(target,
+				num_mem_params, mem_params,
+				num_reg_params, reg_params,
+				exit_point, timeout_ms,
+				arch_info);
 
-	return ERROR_OK;
+	return retval;
 }
 
-/** Runs a Thumb algorithm in the target. */
-int armv7m_run_algorithm(struct target *target,
+/**
+ * Starts a Thumb algorithm in the target and returns while it runs.
+ * The caller's register context is saved in @a arch_info, so the same
+ * struct armv7m_algorithm must be passed to armv7m_wait_algorithm().
+ */
+int armv7m_start_algorithm(struct target *target,
 	int num_mem_params, struct mem_param *mem_params,
 	int num_reg_params, struct reg_param *reg_params,
 	uint32_t entry_point, uint32_t exit_point,
-	int timeout_ms, void *arch_info)
+	void *arch_info)
 {
 	struct armv7m_common *armv7m = target_to_armv7m(target);
 	struct armv7m_algorithm *armv7m_algorithm_info = arch_info;
-	enum armv7m_mode core_mode = armv7m->core_mode;
 	int retval = ERROR_OK;
-	uint32_t context[ARMV7M_NUM_REGS];
 
 	/* NOTE: armv7m_run_algorithm requires that each algorithm uses a software breakpoint
 	 * at the exit point */
@@ -356,8 +349,9 @@ int armv7m_run_algorithm(struct target *target,
 	{
 		if (!armv7m->core_cache->reg_list[i].valid)
 			armv7m->read_core_reg(target, i);
-		context[i] = buf_get_u32(armv7m->core_cache->reg_list[i].value, 0, 32);
+		armv7m_algorithm_info->context[i] = buf_get_u32(armv7m->core_cache->reg_list[i].value, 0, 32);
 	}
+	armv7m_algorithm_info->saved_core_mode = armv7m->core_mode;
 
 	for (int i = 0; i < num_mem_params; i++)
 	{
@@ -395,11 +389,51 @@ int armv7m_run_algorithm(struct target *target,
 		armv7m->core_cache->reg_list[ARMV7M_CONTROL].valid = 1;
 	}
 
-	retval = armv7m_run_and_wait(target, entry_point, timeout_ms, exit_point, armv7m);
+	/* This code relies on the target specific  resume() and  poll()->debug_entry()
+	 * sequence to write register values to the processor and the read them back */
+	return target_resume(target, 0, entry_point, 1, 1);
+}
 
-	if (retval != ERROR_OK)
+/**
+ * Waits for an algorithm started by armv7m_start_algorithm() to reach
+ * @a exit_point, then collects its results and restores the register
+ * context saved in @a arch_info.
+ */
+int armv7m_wait_algorithm(struct target *target,
+	int num_mem_params, struct mem_param *mem_params,
+	int num_reg_params, struct reg_param *reg_params,
+	uint32_t exit_point, int timeout_ms,
+	void *arch_info)
+{
+	struct armv7m_common *armv7m = target_to_armv7m(target);
+	struct armv7m_algorithm *armv7m_algorithm_info = arch_info;
+	int retval = ERROR_OK;
+	uint32_t pc;
+
+	if (armv7m_algorithm_info->common_magic != ARMV7M_COMMON_MAGIC)
 	{
-		return retval;
+		LOG_ERROR("current target isn't an ARMV7M target");
+		return ERROR_TARGET_INVALID;
+	}
+
+	retval = target_wait_state(target, TARGET_HALTED, timeout_ms);
+	/* If the target fails to halt due to the breakpoint, force a halt */
+	if (retval != ERROR_OK || target->state != TARGET_HALTED)
+	{
+		if ((retval = target_halt(target)) != ERROR_OK)
+			return retval;
+		if ((retval = target_wait_state(target, TARGET_HALTED, 500)) != ERROR_OK)
+		{
+			return retval;
+		}
+		return ERROR_TARGET_TIMEOUT;
+	}
+
+	armv7m->load_core_reg_u32(target, ARMV7M_REGISTER_CORE_GP, 15, &pc);
+	if (exit_point && (pc != exit_point))
+	{
+		LOG_DEBUG("failed algorithm halted at 0x%" PRIx32 " ", pc);
+		return ERROR_TARGET_TIMEOUT;
 	}
 
 	/* Read memory values to mem_params[] */
@@ -439,18 +473,19 @@ int armv7m_run_algorithm(struct target *target,
 	{
 		uint32_t regvalue;
 		regvalue = buf_get_u32(armv7m->core_cache->reg_list[i].value, 0, 32);
-		if (regvalue != context[i])
+		if (regvalue != armv7m_algorithm_info->context[i])
 		{
 			LOG_DEBUG("restoring register %s with value 0x%8.8" PRIx32,
-				armv7m->core_cache->reg_list[i].name, context[i]);
+				armv7m->core_cache->reg_list[i].name,
+				armv7m_algorithm_info->context[i]);
 			buf_set_u32(armv7m->core_cache->reg_list[i].value,
-					0, 32, context[i]);
+					0, 32, armv7m_algorithm_info->context[i]);
 			armv7m->core_cache->reg_list[i].valid = 1;
 			armv7m->core_cache->reg_list[i].dirty = 1;
 		}
 	}
 
-	armv7m->core_mode = core_mode;
+	armv7m->core_mode = armv7m_algorithm_info->saved_core_mode;
 
 	return retval;
 }
@@ -553,7 +588,135 @@ int armv7m_init_arch_info(struct target *target, struct armv7m_common *armv7m)
 	return arm_init_arch_info(target, arm);
 }
 
-/** Generates a CRC32 checksum of a memory region. */
+/** Number of bytes checksummed by one run of the table driven algorithm. */
+#define ARMV7M_CRC_CHUNK_SIZE	(256 * 1024)
+
+/**
+ * Download Thumb code given as halfwords into the working area with a
+ * single buffer write, instead of one memory access per halfword.
+ */
+static int armv7m_write_code(struct target *target, uint32_t address,
+		const uint16_t *code, unsigned halfwords)
+{
+	uint8_t buf[64 * sizeof(uint16_t)];
+	unsigned i;
+
+	assert(halfwords <= ARRAY_SIZE(buf) / sizeof(uint16_t));
+
+	for (i = 0; i < halfwords; i++)
+		target_buffer_set_u16(target, buf + i * sizeof(uint16_t), code[i]);
+
+	return target_write_buffer(target, address, halfwords * sizeof(uint16_t), buf);
+}
+
+/**
+ * Calculate the gdb compatible CRC32 of a memory block using a byte-wise
+ * lookup table placed in the working area next to the code. Large blocks
+ * are processed in ARMV7M_CRC_CHUNK_SIZE pieces, the CRC being carried from
+ * one run to the next, so each run has a bounded timeout and the host
+ * keeps servicing its connections in between.
+ *
+ * @returns ERROR_OK, ERROR_TARGET_RESOURCE_NOT_AVAILABLE if the working
+ * area is too small for the table, or another error code.
+ */
+static int armv7m_checksum_memory_table(struct target *target,
+		uint32_t address, uint32_t count, uint32_t* checksum)
+{
+	struct working_area *crc_algorithm;
+	struct armv7m_algorithm armv7m_info;
+	struct reg_param reg_params[4];
+	uint8_t table[256 * sizeof(uint32_t)];
+	uint32_t crc = 0xffffffff;
+	uint32_t code_address;
+	int retval;
+	unsigned i;
+
+	/* see contrib/loaders/checksum/armv7m_crc_table.s for src */
+	static const uint16_t cortex_m3_crc_table_code[] = {
+		0xB149,					/* cbz		r1, done */
+								/* loop: */
+		0xF810, 0x4B01,			/* ldrb		r4, [r0], #1 */
+		0xEA84, 0x6412,			/* eor		r4, r4, r2, lsr #24 */
+		0xF853, 0x4024,			/* ldr		r4, [r3, r4, lsl #2] */
+		0xEA84, 0x2202,			/* eor		r2, r4, r2, lsl #8 */
+		0x1E49,					/* subs		r1, r1, #1 */
+		0xD1F5,					/* bne		loop */
+								/* done: */
+		0x4610,					/* mov		r0, r2 */
+		0xBE00,					/* bkpt		#0 */
+	};
+
+	/* table goes first to keep it word aligned */
+	if (target_alloc_working_area_try(target, sizeof(table) + sizeof(cortex_m3_crc_table_code),
+			&crc_algorithm) != ERROR_OK)
+		return ERROR_TARGET_RESOURCE_NOT_AVAILABLE;
+
+	code_address = crc_algorithm->address + sizeof(table);
+
+	/* same table as image_calculate_checksum(), as per gdb */
+	for (i = 0; i < 256; i++)
+		target_buffer_set_u32(target, table + i * sizeof(uint32_t),
+				image_crc32_table[0][i]);
+
+	retval = target_write_buffer(target, crc_algorithm->address, sizeof(table), table);
+	if (retval == ERROR_OK)
+		retval = armv7m_write_code(target, code_address, cortex_m3_crc_table_code,
+				ARRAY_SIZE(cortex_m3_crc_table_code));
+	if (retval != ERROR_OK)
+	{
+		target_free_working_area(target, crc_algorithm);
+		return retval;
+	}
+
+	armv7m_info.common_magic = ARMV7M_COMMON_MAGIC;
+	armv7m_info.core_mode = ARMV7M_MODE_ANY;
+
+	init_reg_param(&reg_params[0], "r0", 32, PARAM_IN_OUT);
+	init_reg_param(&reg_params[1], "r1", 32, PARAM_OUT);
+	init_reg_param(&reg_params[2], "r2", 32, PARAM_OUT);
+	init_reg_param(&reg_params[3], "r3", 32, PARAM_OUT);
+
+	buf_set_u32(reg_params[3].value, 0, 32, crc_algorithm->address);
+
+	while (count > 0)
+	{
+		uint32_t chunk = count;
+		if (chunk > ARMV7M_CRC_CHUNK_SIZE)
+			chunk = ARMV7M_CRC_CHUNK_SIZE;
+
+		buf_set_u32(reg_params[0].value, 0, 32, address);
+		buf_set_u32(reg_params[1].value, 0, 32, chunk);
+		buf_set_u32(reg_params[2].value, 0, 32, crc);
+
+		retval = target_run_algorithm(target, 0, NULL, 4, reg_params,
+				code_address, code_address + (sizeof(cortex_m3_crc_table_code) - 2),
+				20000, &armv7m_info);
+		if (retval != ERROR_OK)
+		{
+			LOG_ERROR("error executing cortex_m3 crc algorithm");
+			break;
+		}
+
+		crc = buf_get_u32(reg_params[0].value, 0, 32);
+		address += chunk;
+		count -= chunk;
+		keep_alive();
+	}
+
+	for (i = 0; i < ARRAY_SIZE(reg_params); i++)
+		destroy_reg_param(&reg_params[i]);
+
+	target_free_working_area(target, crc_algorithm);
+
+	if (retval == ERROR_OK)
+		*checksum = crc;
+	return retval;
+}
+
+/** Generates a CRC32 checksum of a memory region. A table driven algorithm
+ * is used when the working area can hold its lookup table, otherwise a
+ * smaller bit-wise one.
+ */
 int armv7m_checksum_memory(struct target *target,
 		uint32_t address, uint32_t count, uint32_t* checksum)
 {
@@ -562,6 +725,12 @@ int armv7m_checksum_memory(struct target *target,
 	struct reg_param reg_params[2];
 	int retval;
 
+	retval = armv7m_checksum_memory_table(target, address, count, checksum);
+	if (retval != ERROR_TARGET_RESOURCE_NOT_AVAILABLE)
+		return retval;
+
+	LOG_DEBUG("not enough working area for crc table, using bit-wise crc");
+
 	/* see contib/loaders/checksum/armv7m_crc.s for src */
 
 	static const uint16_t cortex_m3_crc_code[] = {
@@ -594,19 +763,18 @@ int armv7m_checksum_memory(struct target *target,
 		0x1DB7, 0x04C1			/* CRC32XOR:	.word 0x04C11DB7 */
 	};
 
-	uint32_t i;
-
 	if (target_alloc_working_area(target, sizeof(cortex_m3_crc_code), &crc_algorithm) != ERROR_OK)
 	{
 		return ERROR_TARGET_RESOURCE_NOT_AVAILABLE;
 	}
 
-	/* convert flash writing code into a buffer in target endianness */
-	for (i = 0; i < ARRAY_SIZE(cortex_m3_crc_code); i++)
-		if ((retval = target_write_u16(target, crc_algorithm->address + i*sizeof(uint16_t), cortex_m3_crc_code[i])) != ERROR_OK)
-		{
-			return retval;
-		}
+	retval = armv7m_write_code(target, crc_algorithm->address, cortex_m3_crc_code,
+			ARRAY_SIZE(cortex_m3_crc_code));
+	if (retval != ERROR_OK)
+	{
+		target_free_working_area(target, crc_algorithm);
+		return retval;
+	}
 
 	armv7m_info.common_magic = ARMV7M_COMMON_MAGIC;
 	armv7m_info.core_mode = ARMV7M_MODE_ANY;
@@ -94,6 +94,8 @@ enum
 	ARMV7M_BASEPRI,
 	ARMV7M_FAULTMASK,
 	ARMV7M_CONTROL,
+
+	ARMV7M_LAST_REG,
 };
 
 #define ARMV7M_COMMON_MAGIC 0x2A452A45
@@ -142,6 +144,10 @@ struct armv7m_algorithm
 	int common_magic;
 
 	enum armv7m_mode core_mode;
+
+	/* state saved by armv7m_start_algorithm() for armv7m_wait_algorithm() */
+	enum armv7m_mode saved_core_mode;
+	uint32_t context[ARMV7M_LAST_REG];
 };
 
 struct armv7m_core_reg
@@ -168,6 +174,18 @@ int armv7m_run_algorithm(struct target *target,
 		uint32_t entry_point, uint32_t exit_point,
 		int timeout_ms, void *arch_info);
 
+int armv7m_start_algorithm(struct target *target,
+		int num_mem_params, struct mem_param *mem_params,
+		int num_reg_params, struct reg_param *reg_params,
+		uint32_t entry_point, uint32_t exit_point,
+		void *arch_info);
+
+int armv7m_wait_algorithm(struct target *target,
+		int num_mem_params, struct mem_param *mem_params,
+		int num_reg_params, struct reg_param *reg_params,
+		uint32_t exit_point, int timeout_ms,
+		void *arch_info);
+
 int armv7m_invalidate_core_regs(struct target *target);
 
 int armv7m_restore_context(struct target *target);
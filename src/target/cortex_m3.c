@@ -39,6 +39,7 @@
 #include "register.h"
 #include "arm_opcodes.h"
 #include "arm_semihosting.h"
+#include <helper/time_support.h>
 
 /* NOTE:  most of this should work fine for the Cortex-M1 and
  * Cortex-M0 cores too, although they're ARMv6-M not ARMv7-M.
@@ -1647,6 +1648,78 @@ static int cortex_m3_bulk_write_memory(struct target *target, uint32_t address,
 	return cortex_m3_write_memory(target, address, 4, count, buffer);
 }
 
+/* Number of DWT_PCSR reads queued per DAP round trip */
+#define CORTEX_M3_PCSR_BATCH	64
+
+/* Sample the PC through DWT_PCSR while the core keeps running, instead
+ * of halting and resuming it for every sample.
+ */
+static int cortex_m3_profiling(struct target *target,
+		struct target_profile *profile, uint32_t seconds)
+{
+	struct cortex_m3_common *cortex_m3 = target_to_cm3(target);
+	struct adiv5_dap *swjdp = &cortex_m3->armv7m.dap;
+	uint32_t pcsr[CORTEX_M3_PCSR_BATCH];
+	bool first = true;
+	int64_t timeout;
+	int retval;
+	int i;
+
+	/* PCSR lives in the DWT, which is optional */
+	if (cortex_m3->dwt_num_comp == 0)
+		return target_profiling_default(target, profile, seconds);
+
+	if (target->state == TARGET_HALTED)
+	{
+		retval = target_resume(target, 1, 0, 0, 0);
+		if (retval != ERROR_OK)
+			return retval;
+	}
+
+	timeout = timeval_ms() + seconds * 1000LL;
+	while (timeval_ms() < timeout)
+	{
+		/* repeated reads of one address reuse the TAR setup, so each
+		 * sample costs a single AP read in the queue */
+		for (i = 0; i < CORTEX_M3_PCSR_BATCH; i++)
+		{
+			retval = mem_ap_read_u32(swjdp, DWT_PCSR, &pcsr[i]);
+			if (retval != ERROR_OK)
+				return retval;
+		}
+		retval = dap_run(swjdp);
+		if (retval != ERROR_OK)
+			return retval;
+
+		if (first)
+		{
+			/* PCSR is optional even with a DWT and then reads as zero */
+			for (i = 0; (i < CORTEX_M3_PCSR_BATCH) && (pcsr[i] == 0); i++)
+				;
+			if (i == CORTEX_M3_PCSR_BATCH)
+			{
+				LOG_INFO("DWT_PCSR not implemented, halting to sample the PC");
+				return target_profiling_default(target, profile, seconds);
+			}
+			first = false;
+		}
+
+		for (i = 0; i < CORTEX_M3_PCSR_BATCH; i++)
+		{
+			/* all ones while the core is halted */
+			if (pcsr[i] == 0xFFFFFFFF)
+				continue;
+			retval = target_profile_add_sample(profile, pcsr[i]);
+			if (retval != ERROR_OK)
+				return retval;
+		}
+
+		keep_alive();
+	}
+
+	return ERROR_OK;
+}
+
 static int cortex_m3_init_target(struct command_context *cmd_ctx,
 		struct target *target)
 {
@@ -2223,6 +2296,9 @@ struct target_type cortexm3_target =
 	.blank_check_memory = armv7m_blank_check_memory,
 
 	.run_algorithm = armv7m_run_algorithm,
+	.start_algorithm = armv7m_start_algorithm,
+	.wait_algorithm = armv7m_wait_algorithm,
+	.profiling = cortex_m3_profiling,
 
 	.add_breakpoint = cortex_m3_add_breakpoint,
 	.remove_breakpoint = cortex_m3_remove_breakpoint,
@@ -634,42 +634,188 @@ static struct etm_capture_driver *etm_capture_drivers[] =
 	NULL
 };
 
-static int etm_read_instruction(struct etm_context *ctx, struct arm_instruction *instruction)
+/* Decoded instructions kept by etm_read_instruction(), a power of two */
+#define ETM_DECODE_CACHE_SIZE	4096
+
+/* One image section, read into memory once for trace analysis */
+struct etm_image_section
+{
+	uint32_t base_address;
+	uint32_t size;
+	uint8_t *data;
+};
+
+struct etm_decode_entry
 {
+	uint32_t address;
+	int core_state;		/* -1 marks an unused entry */
+	struct arm_instruction instruction;
+};
+
+/* In-memory copy of the trace image, with sections sorted by address,
+ * and a direct mapped cache of instructions decoded from it.  Traces
+ * mostly run in loops, so most lookups hit the cache and the rest the
+ * section that served the previous one.
+ */
+struct etm_image_index
+{
+	int num_sections;
+	struct etm_image_section *sections;
+	int last_section;
+	struct etm_decode_entry *cache;
+};
+
+static void etm_image_index_free(struct etm_context *ctx)
+{
+	struct etm_image_index *index = ctx->image_index;
 	int i;
-	int section = -1;
+
+	if (!index)
+		return;
+
+	for (i = 0; i < index->num_sections; i++)
+		free(index->sections[i].data);
+	free(index->sections);
+	free(index->cache);
+	free(index);
+	ctx->image_index = NULL;
+}
+
+static int etm_image_section_compare(const void *a, const void *b)
+{
+	const struct etm_image_section *sa = a, *sb = b;
+
+	if (sa->base_address < sb->base_address)
+		return -1;
+	return sa->base_address > sb->base_address;
+}
+
+/* read all sections of the trace image and sort them by address */
+static int etm_image_index_build(struct etm_context *ctx)
+{
+	struct etm_image_index *index;
+	struct image *image = ctx->image;
 	size_t size_read;
+	int i;
+
+	index = calloc(1, sizeof(struct etm_image_index));
+	if (!index)
+		return ERROR_FAIL;
+	ctx->image_index = index;
+
+	index->sections = calloc(image->num_sections, sizeof(struct etm_image_section));
+	index->cache = malloc(ETM_DECODE_CACHE_SIZE * sizeof(struct etm_decode_entry));
+	if ((!index->sections && image->num_sections) || !index->cache)
+		goto fail;
+
+	for (i = 0; i < ETM_DECODE_CACHE_SIZE; i++)
+		index->cache[i].core_state = -1;
+
+	for (i = 0; i < image->num_sections; i++)
+	{
+		struct etm_image_section *section = index->sections + index->num_sections;
+
+		if (image->sections[i].size == 0)
+			continue;
+
+		section->base_address = image->sections[i].base_address;
+		section->size = image->sections[i].size;
+		section->data = malloc(section->size);
+		if (!section->data)
+			goto fail;
+		index->num_sections++;
+
+		if (image_read_section(image, i, 0, section->size,
+				section->data, &size_read) != ERROR_OK
+				|| size_read != section->size)
+		{
+			LOG_ERROR("error while reading image section %i", i);
+			goto fail;
+		}
+	}
+
+	qsort(index->sections, index->num_sections,
+			sizeof(struct etm_image_section), etm_image_section_compare);
+
+	return ERROR_OK;
+
+fail:
+	etm_image_index_free(ctx);
+	return ERROR_FAIL;
+}
+
+/* find the in-memory copy of 'size' image bytes at 'address' */
+static uint8_t *etm_image_lookup(struct etm_image_index *index,
+		uint32_t address, uint32_t size)
+{
+	struct etm_image_section *section;
+	int lo = 0, hi = index->num_sections - 1;
+
+	section = index->sections + index->last_section;
+	if (index->num_sections == 0 || address < section->base_address
+			|| address - section->base_address >= section->size)
+	{
+		/* last section with base_address <= address */
+		section = NULL;
+		while (lo <= hi)
+		{
+			int mid = (lo + hi) / 2;
+
+			if (index->sections[mid].base_address <= address)
+			{
+				section = index->sections + mid;
+				lo = mid + 1;
+			}
+			else
+				hi = mid - 1;
+		}
+		if (!section || address - section->base_address >= section->size)
+			return NULL;
+		index->last_section = section - index->sections;
+	}
+
+	if (section->size - (address - section->base_address) < size)
+		return NULL;
+
+	return section->data + (address - section->base_address);
+}
+
+static int etm_read_instruction(struct etm_context *ctx, struct arm_instruction *instruction)
+{
+	struct etm_decode_entry *entry;
 	uint32_t opcode;
-	int retval;
+	uint8_t *buf;
 
 	if (!ctx->image)
 		return ERROR_TRACE_IMAGE_UNAVAILABLE;
 
-	/* search for the section the current instruction belongs to */
-	for (i = 0; i < ctx->image->num_sections; i++)
+	if (!ctx->image_index)
 	{
-		if ((ctx->image->sections[i].base_address <= ctx->current_pc) &&
-			(ctx->image->sections[i].base_address + ctx->image->sections[i].size > ctx->current_pc))
+		/* don't re-read the whole image for every instruction */
+		if (ctx->image_index_failed)
+			return ERROR_TRACE_IMAGE_UNAVAILABLE;
+		if (etm_image_index_build(ctx) != ERROR_OK)
 		{
-			section = i;
-			break;
+			LOG_ERROR("error while reading trace image");
+			ctx->image_index_failed = true;
+			return ERROR_TRACE_IMAGE_UNAVAILABLE;
 		}
 	}
 
-	if (section == -1)
+	entry = ctx->image_index->cache
+		+ ((ctx->current_pc >> 1) & (ETM_DECODE_CACHE_SIZE - 1));
+	if (entry->address == ctx->current_pc && entry->core_state == ctx->core_state)
 	{
-		/* current instruction couldn't be found in the image */
-		return ERROR_TRACE_INSTRUCTION_UNAVAILABLE;
+		*instruction = entry->instruction;
+		return ERROR_OK;
 	}
 
 	if (ctx->core_state == ARM_STATE_ARM)
 	{
-		uint8_t buf[4];
-		if ((retval = image_read_section(ctx->image, section,
-			ctx->current_pc - ctx->image->sections[section].base_address,
-			4, buf, &size_read)) != ERROR_OK)
+		buf = etm_image_lookup(ctx->image_index, ctx->current_pc, 4);
+		if (!buf)
 		{
-			LOG_ERROR("error while reading instruction");
+			/* current instruction couldn't be found in the image */
 			return ERROR_TRACE_INSTRUCTION_UNAVAILABLE;
 		}
 		opcode = target_buffer_get_u32(ctx->target, buf);
@@ -677,12 +823,10 @@ static int etm_read_instruction(struct etm_context *ctx, struct arm_instruction
 	}
 	else if (ctx->core_state == ARM_STATE_THUMB)
 	{
-		uint8_t buf[2];
-		if ((retval = image_read_section(ctx->image, section,
-			ctx->current_pc - ctx->image->sections[section].base_address,
-			2, buf, &size_read)) != ERROR_OK)
+		buf = etm_image_lookup(ctx->image_index, ctx->current_pc, 2);
+		if (!buf)
 		{
-			LOG_ERROR("error while reading instruction");
+			/* current instruction couldn't be found in the image */
 			return ERROR_TRACE_INSTRUCTION_UNAVAILABLE;
 		}
 		opcode = target_buffer_get_u16(ctx->target, buf);
@@ -699,6 +843,10 @@ static int etm_read_instruction(struct etm_context *ctx, struct arm_instruction
 		return ERROR_FAIL;
 	}
 
+	entry->address = ctx->current_pc;
+	entry->core_state = ctx->core_state;
+	entry->instruction = *instruction;
+
 	return ERROR_OK;
 }
 
@@ -1758,6 +1906,8 @@ COMMAND_HANDLER(handle_etm_image_command)
 		return ERROR_FAIL;
 	}
 
+	etm_image_index_free(etm_ctx);
+	etm_ctx->image_index_failed = false;
 	if (etm_ctx->image)
 	{
 		image_close(etm_ctx->image);
@@ -136,6 +136,7 @@ enum
 
 /* forward-declare ETM context */
 struct etm_context;
+struct etm_image_index;
 
 struct etm_capture_driver
 {
@@ -178,6 +179,8 @@ struct etm_context
 	uint32_t control;	/* shadow of ETM_CTRL */
 	int /*arm_state*/ core_state;	/* current core state */
 	struct image *image;		/* source for target opcodes */
+	struct etm_image_index *image_index;	/* image copy and decode cache, built on first use */
+	bool image_index_failed;	/* image couldn't be read, don't retry until a new one is loaded */
 	uint32_t pipe_index;		/* current trace cycle */
 	uint32_t data_index;		/* cycle holding next data packet */
 	bool data_half;			/* port half on a 16 bit port */
@@ -111,6 +111,10 @@ int image_add_section(struct image *image, uint32_t base, uint32_t size,
 int image_calculate_checksum(uint8_t* buffer, uint32_t nbytes,
 		uint32_t* checksum);
 
+/* CRC-32 slicing-by-8 tables of image_calculate_checksum(), [0] is the
+ * plain byte-at-a-time table */
+extern const uint32_t image_crc32_table[8][256];
+
 #define ERROR_IMAGE_FORMAT_ERROR	(-1400)
 #define ERROR_IMAGE_TYPE_UNKNOWN	(-1401)
 #define ERROR_IMAGE_TEMPORARILY_UNAVAILABLE		(-1402)
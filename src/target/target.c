@@ -48,6 +48,7 @@
 #include "target_request.h"
 #include "breakpoints.h"
 #include "register.h"
+#include "algorithm.h"
 #include "trace.h"
 #include "image.h"
 #include "rtos/rtos.h"
@@ -503,6 +504,14 @@ int target_resume(struct target *target, int current, uint32_t address, int hand
 		return ERROR_FAIL;
 	}
 
+	/* the application gets its memory back before it runs again */
+	if (!debug_execution)
+	{
+		retval = target_restore_working_memory(target);
+		if (retval != ERROR_OK)
+			return retval;
+	}
+
 	/* note that resume *must* be asynchronous. The CPU can halt before
 	 * we poll. The CPU can even halt at the current PC as a result of
 	 * a software breakpoint being inserted by (a bug?) the application.
@@ -659,6 +668,232 @@ static int target_soft_reset_halt_imp(struct target *target)
 	return target->type->soft_reset_halt_imp(target);
 }
 
+/* With -work-area-backup, the original content of the working memory is
+ * saved a word at a time right before the host first overwrites it, and
+ * only written back when the target is about to run on its own, or when
+ * someone else reads or writes that memory after its area was freed.
+ * Flash buffers which are only partly filled thus cost neither a full
+ * read nor a full write.
+ */
+#define WA_WORD_SAVED(target, w) \
+	((target)->working_area_saved[(w) / 32] & (1u << ((w) % 32)))
+
+static bool target_backup_active(struct target *target)
+{
+	return target->backup_working_area && target->working_areas;
+}
+
+/* clip [address, address + size) to working memory words [*first, *last) */
+static bool target_backup_words(struct target *target, uint32_t address,
+		uint32_t size, uint32_t *first, uint32_t *last)
+{
+	uint32_t start = target->working_area;
+	uint32_t end = start + (target->working_area_size & ~3);
+
+	if (size == 0 || address >= end || address + size <= start)
+		return false;
+
+	if (address < start)
+	{
+		size -= start - address;
+		address = start;
+	}
+	if (size > end - address)
+		size = end - address;
+
+	*first = (address - start) / 4;
+	*last = (address - start + size + 3) / 4;
+	return true;
+}
+
+/* save whatever part of the range has not been saved yet */
+static int target_backup_range(struct target *target, uint32_t address, uint32_t size)
+{
+	uint32_t w, last;
+	int retval;
+
+	if (!target_backup_words(target, address, size, &w, &last))
+		return ERROR_OK;
+
+	if (!target->working_area_saved)
+	{
+		uint32_t words = target->working_area_size / 4;
+
+		target->working_area_backup = malloc(words * 4);
+		target->working_area_saved = calloc((words + 31) / 32, sizeof(uint32_t));
+		if (!target->working_area_backup || !target->working_area_saved)
+		{
+			free(target->working_area_backup);
+			target->working_area_backup = NULL;
+			free(target->working_area_saved);
+			target->working_area_saved = NULL;
+			return ERROR_FAIL;
+		}
+	}
+
+	while (w < last)
+	{
+		uint32_t run;
+
+		if (WA_WORD_SAVED(target, w))
+		{
+			w++;
+			continue;
+		}
+		for (run = w; run < last && !WA_WORD_SAVED(target, run); run++)
+			;
+
+		retval = target->type->read_memory(target,
+				target->working_area + w * 4, 4, run - w,
+				target->working_area_backup + w * 4);
+		if (retval != ERROR_OK)
+			return retval;
+
+		for (; w < run; w++)
+			target->working_area_saved[w / 32] |= 1u << (w % 32);
+	}
+
+	return ERROR_OK;
+}
+
+/* write back and forget the saved words in the range */
+static int target_restore_range(struct target *target, uint32_t address, uint32_t size)
+{
+	uint32_t w, last;
+	int retval;
+
+	if (!target->working_area_saved
+			|| !target_backup_words(target, address, size, &w, &last))
+		return ERROR_OK;
+
+	while (w < last)
+	{
+		uint32_t run;
+
+		if (!WA_WORD_SAVED(target, w))
+		{
+			w++;
+			continue;
+		}
+		for (run = w; run < last && WA_WORD_SAVED(target, run); run++)
+			;
+
+		retval = target->type->write_memory(target,
+				target->working_area + w * 4, 4, run - w,
+				target->working_area_backup + w * 4);
+		if (retval != ERROR_OK)
+			return retval;
+
+		for (; w < run; w++)
+			target->working_area_saved[w / 32] &= ~(1u << (w % 32));
+	}
+
+	return ERROR_OK;
+}
+
+/* intersection of [address, address + size) with area @a c */
+static bool target_area_overlap(struct working_area *c,
+		uint32_t address, uint32_t size, uint32_t *start, uint32_t *len)
+{
+	uint32_t end = address + size;
+
+	if (address >= c->address + c->size || end <= c->address)
+		return false;
+
+	*start = address > c->address ? address : c->address;
+	*len = (end < c->address + c->size ? end : c->address + c->size) - *start;
+	return true;
+}
+
+/**
+ * Called before the host reads (@a write false) or writes working memory.
+ * Writes into allocated areas get the original content saved first; any
+ * access to memory outside allocated areas sees it restored.
+ */
+static int target_backup_access(struct target *target,
+		uint32_t address, uint32_t size, bool write)
+{
+	struct working_area *c;
+	uint32_t start, len;
+	int retval;
+
+	if (!target_backup_active(target))
+		return ERROR_OK;
+
+	for (c = target->working_areas; c; c = c->next)
+	{
+		if (!target_area_overlap(c, address, size, &start, &len))
+			continue;
+
+		if (c->free)
+			retval = target_restore_range(target, start, len);
+		else if (write)
+			retval = target_backup_range(target, start, len);
+		else
+			continue;
+		if (retval != ERROR_OK)
+			return retval;
+	}
+
+	return ERROR_OK;
+}
+
+/* An algorithm may write anywhere in the areas it was given, except
+ * where their owner marked them as scratch.
+ */
+static int target_backup_algorithm(struct target *target,
+		int num_mem_params, struct mem_param *mem_params)
+{
+	struct working_area *c;
+	int retval;
+	int i;
+
+	if (!target_backup_active(target))
+		return ERROR_OK;
+
+	for (c = target->working_areas; c; c = c->next)
+	{
+		if (c->free || c->scratch)
+			continue;
+		retval = target_backup_range(target, c->address, c->size);
+		if (retval != ERROR_OK)
+			return retval;
+	}
+
+	for (i = 0; i < num_mem_params; i++)
+	{
+		retval = target_backup_range(target,
+				mem_params[i].address, mem_params[i].size);
+		if (retval != ERROR_OK)
+			return retval;
+	}
+
+	return ERROR_OK;
+}
+
+int target_restore_working_memory(struct target *target)
+{
+	if (!target_backup_active(target))
+		return ERROR_OK;
+
+	return target_restore_range(target, target->working_area,
+			target->working_area_size);
+}
+
+void target_quit(void)
+{
+	struct target *target;
+
+	for (target = all_targets; target; target = target->next)
+	{
+		if (!target_was_examined(target))
+			continue;
+		if (target_restore_working_memory(target) != ERROR_OK)
+			LOG_WARNING("%s: could not restore the working area",
+					target_name(target));
+	}
+}
+
 /**
  * Downloads a target-specific native code algorithm to the target,
  * and executes it.  * Note that some targets may need to set up, enable,
@@ -689,6 +924,10 @@ int target_run_algorithm(struct target *target,
 		goto done;
 	}
 
+	retval = target_backup_algorithm(target, num_mem_params, mem_params);
+	if (retval != ERROR_OK)
+		goto done;
+
 	target->running_alg = true;
 	retval = target->type->run_algorithm(target,
 			num_mem_params, mem_params,
@@ -700,34 +939,301 @@ done:
 	return retval;
 }
 
+/**
+ * Starts a target-specific native code algorithm on the target and
+ * returns while it runs; target_wait_algorithm() must follow.  This lets
+ * the host keep feeding the algorithm (see
+ * target_run_flash_async_algorithm()) instead of waiting on it.
+ *
+ * @param target used to run the algorithm
+ * @param arch_info target-specific description of the algorithm; it also
+ * holds the state needed by target_wait_algorithm().
+ */
+int target_start_algorithm(struct target *target,
+		int num_mem_params, struct mem_param *mem_params,
+		int num_reg_params, struct reg_param *reg_params,
+		uint32_t entry_point, uint32_t exit_point,
+		void *arch_info)
+{
+	int retval = ERROR_FAIL;
+
+	if (!target_was_examined(target))
+	{
+		LOG_ERROR("Target not examined yet");
+		goto done;
+	}
+	if (!target->type->start_algorithm) {
+		LOG_ERROR("Target type '%s' does not support %s",
+				target_type_name(target), __func__);
+		goto done;
+	}
+	if (target->running_alg) {
+		LOG_ERROR("Target is already running an algorithm");
+		goto done;
+	}
+
+	retval = target_backup_algorithm(target, num_mem_params, mem_params);
+	if (retval != ERROR_OK)
+		goto done;
+
+	target->running_alg = true;
+	retval = target->type->start_algorithm(target,
+			num_mem_params, mem_params,
+			num_reg_params, reg_params,
+			entry_point, exit_point, arch_info);
+	if (retval != ERROR_OK)
+		target->running_alg = false;
+
+done:
+	return retval;
+}
+
+/**
+ * Waits for an algorithm started with target_start_algorithm() to reach
+ * its exit point, then collects its results and restores the target.
+ *
+ * @param target used to run the algorithm
+ * @param arch_info the same description passed to target_start_algorithm()
+ */
+int target_wait_algorithm(struct target *target,
+		int num_mem_params, struct mem_param *mem_params,
+		int num_reg_params, struct reg_param *reg_params,
+		uint32_t exit_point, int timeout_ms,
+		void *arch_info)
+{
+	int retval = ERROR_FAIL;
+
+	if (!target->type->wait_algorithm) {
+		LOG_ERROR("Target type '%s' does not support %s",
+				target_type_name(target), __func__);
+		goto done;
+	}
+	if (!target->running_alg) {
+		LOG_ERROR("Target is not running an algorithm");
+		goto done;
+	}
+
+	retval = target->type->wait_algorithm(target,
+			num_mem_params, mem_params,
+			num_reg_params, reg_params,
+			exit_point, timeout_ms, arch_info);
+	target->running_alg = false;
+
+done:
+	return retval;
+}
+
+/* how long the host waits for the algorithm to free FIFO space */
+#define ASYNC_ALGORITHM_POLL_MS		10
+#define ASYNC_ALGORITHM_TIMEOUT_MS	5000
+
+int target_run_flash_async_algorithm(struct target *target,
+		const uint8_t *buffer, uint32_t count, int block_size,
+		int num_mem_params, struct mem_param *mem_params,
+		int num_reg_params, struct reg_param *reg_params,
+		uint32_t buffer_start, uint32_t buffer_size,
+		uint32_t entry_point, uint32_t exit_point,
+		void *arch_info)
+{
+	int retval, retval2;
+	int idle_ms = 0;
+
+	uint32_t wp_addr = buffer_start;
+	uint32_t rp_addr = buffer_start + 4;
+	uint32_t fifo_start = buffer_start + 8;
+	uint32_t fifo_end = buffer_start + buffer_size;
+
+	uint32_t wp = fifo_start;
+	uint32_t rp = fifo_start;
+
+	/* the FIFO is handled in whole blocks; block_size must be 2^n */
+	assert(block_size > 0 && !(block_size & (block_size - 1)));
+	assert(!(buffer_start & 3) && !(buffer_size & (block_size - 1)));
+
+	if (buffer_size < 8 + 2 * (uint32_t)block_size)
+	{
+		LOG_ERROR("async algorithm FIFO of %" PRIu32 " bytes is too small",
+				buffer_size);
+		return ERROR_TARGET_RESOURCE_NOT_AVAILABLE;
+	}
+
+	retval = target_write_u32(target, wp_addr, wp);
+	if (retval != ERROR_OK)
+		return retval;
+	retval = target_write_u32(target, rp_addr, rp);
+	if (retval != ERROR_OK)
+		return retval;
+
+	/* the algorithm idles on the empty FIFO until the first data lands */
+	retval = target_start_algorithm(target,
+			num_mem_params, mem_params,
+			num_reg_params, reg_params,
+			entry_point, exit_point, arch_info);
+	if (retval != ERROR_OK)
+	{
+		LOG_ERROR("error starting target algorithm");
+		return retval;
+	}
+
+	while (count > 0)
+	{
+		uint32_t thisrun_bytes;
+
+		retval = target_read_u32(target, rp_addr, &rp);
+		if (retval != ERROR_OK)
+		{
+			LOG_ERROR("failed to read the algorithm's FIFO read pointer");
+			break;
+		}
+
+		if (rp == 0)
+		{
+			LOG_ERROR("target algorithm reported failure");
+			retval = ERROR_TARGET_FAILURE;
+			break;
+		}
+
+		if ((rp & (block_size - 1)) || rp < fifo_start || rp >= fifo_end)
+		{
+			LOG_ERROR("corrupted FIFO read pointer 0x%" PRIx32, rp);
+			retval = ERROR_TARGET_FAILURE;
+			break;
+		}
+
+		/* Free space up to the wrap point.  The FIFO is never filled
+		 * completely, since wp == rp means empty.
+		 */
+		if (rp > wp)
+			thisrun_bytes = rp - wp - block_size;
+		else if (rp > fifo_start)
+			thisrun_bytes = fifo_end - wp;
+		else
+			thisrun_bytes = fifo_end - wp - block_size;
+
+		if (thisrun_bytes == 0)
+		{
+			/* USB round trips usually outlast flash programming;
+			 * only a fast adapter ends up waiting here.
+			 */
+			if (idle_ms >= ASYNC_ALGORITHM_TIMEOUT_MS)
+			{
+				LOG_ERROR("timeout waiting for the target algorithm");
+				retval = ERROR_TARGET_TIMEOUT;
+				break;
+			}
+			alive_sleep(ASYNC_ALGORITHM_POLL_MS);
+			idle_ms += ASYNC_ALGORITHM_POLL_MS;
+			continue;
+		}
+		idle_ms = 0;
+
+		if (thisrun_bytes > count * block_size)
+			thisrun_bytes = count * block_size;
+
+		retval = target_write_buffer(target, wp, thisrun_bytes, buffer);
+		if (retval != ERROR_OK)
+			break;
+
+		buffer += thisrun_bytes;
+		count -= thisrun_bytes / block_size;
+		wp += thisrun_bytes;
+		if (wp >= fifo_end)
+			wp = fifo_start;
+
+		/* publish the data only once it is all in place */
+		retval = target_write_u32(target, wp_addr, wp);
+		if (retval != ERROR_OK)
+			break;
+	}
+
+	/* on failure, wp = 0 tells the algorithm to stop early */
+	if (retval != ERROR_OK)
+		target_write_u32(target, wp_addr, 0);
+
+	retval2 = target_wait_algorithm(target,
+			num_mem_params, mem_params,
+			num_reg_params, reg_params,
+			exit_point, 10000, arch_info);
+	if (retval2 != ERROR_OK)
+	{
+		LOG_ERROR("error waiting for target algorithm");
+		if (retval == ERROR_OK)
+			retval = retval2;
+	}
+
+	/* the algorithm may have failed on the last blocks, after the host
+	 * had nothing left to send
+	 */
+	if (retval == ERROR_OK)
+	{
+		retval = target_read_u32(target, rp_addr, &rp);
+		if (retval != ERROR_OK)
+			LOG_ERROR("failed to read the algorithm's FIFO read pointer");
+		else if (rp == 0)
+		{
+			LOG_ERROR("target algorithm reported failure");
+			retval = ERROR_TARGET_FAILURE;
+		}
+	}
+
+	return retval;
+}
+
 
 int target_read_memory(struct target *target,
 		uint32_t address, uint32_t size, uint32_t count, uint8_t *buffer)
 {
+	int retval = target_backup_access(target, address, size * count, false);
+	if (retval != ERROR_OK)
+		return retval;
 	return target->type->read_memory(target, address, size, count, buffer);
 }
 
 static int target_read_phys_memory(struct target *target,
 		uint32_t address, uint32_t size, uint32_t count, uint8_t *buffer)
 {
+	int retval = target_backup_access(target, address, size * count, false);
+	if (retval != ERROR_OK)
+		return retval;
 	return target->type->read_phys_memory(target, address, size, count, buffer);
 }
 
+static void target_invalidate_loaders(struct target *target,
+		uint32_t address, uint32_t size);
+
 int target_write_memory(struct target *target,
 		uint32_t address, uint32_t size, uint32_t count, const uint8_t *buffer)
 {
+	int retval = target_backup_access(target, address, size * count, true);
+	if (retval != ERROR_OK)
+		return retval;
+	target_invalidate_loaders(target, address, size * count);
+	if (target->rtos)
+		rtos_cache_invalidate(target->rtos);
 	return target->type->write_memory(target, address, size, count, buffer);
 }
 
 static int target_write_phys_memory(struct target *target,
 		uint32_t address, uint32_t size, uint32_t count, const uint8_t *buffer)
 {
+	int retval = target_backup_access(target, address, size * count, true);
+	if (retval != ERROR_OK)
+		return retval;
+	target_invalidate_loaders(target, address, size * count);
+	if (target->rtos)
+		rtos_cache_invalidate(target->rtos);
 	return target->type->write_phys_memory(target, address, size, count, buffer);
 }
 
 int target_bulk_write_memory(struct target *target,
 		uint32_t address, uint32_t count, const uint8_t *buffer)
 {
+	int retval = target_backup_access(target, address, 4 * count, true);
+	if (retval != ERROR_OK)
+		return retval;
+	target_invalidate_loaders(target, address, 4 * count);
+	if (target->rtos)
+		rtos_cache_invalidate(target->rtos);
 	return target->type->bulk_write_memory(target, address, count, buffer);
 }
 
@@ -769,6 +1275,11 @@ int target_get_gdb_reg_list(struct target *target,
 int target_step(struct target *target,
 		int current, uint32_t address, int handle_breakpoints)
 {
+	/* stepping runs application code too */
+	int retval = target_restore_working_memory(target);
+	if (retval != ERROR_OK)
+		return retval;
+
 	return target->type->step(target, current, address, handle_breakpoints);
 }
 
@@ -1019,7 +1530,7 @@ int target_unregister_event_callback(int (*callback)(struct target *target, enum
 	return ERROR_OK;
 }
 
-static int target_unregister_timer_callback(int (*callback)(void *priv), void *priv)
+int target_unregister_timer_callback(int (*callback)(void *priv), void *priv)
 {
 	struct target_timer_callback **p = &target_timer_callbacks;
 	struct target_timer_callback *c = target_timer_callbacks;
@@ -1142,9 +1653,137 @@ int target_call_timer_callbacks_now(void)
 	return target_call_timer_callbacks_check_time(0);
 }
 
-int target_alloc_working_area_try(struct target *target, uint32_t size, struct working_area **area)
+int target_timer_callbacks_next_ms(void)
+{
+	struct target_timer_callback *callback;
+	struct timeval now;
+	long next_ms = -1;
+
+	gettimeofday(&now, NULL);
+
+	for (callback = target_timer_callbacks; callback; callback = callback->next)
+	{
+		long ms;
+
+		if (!callback->callback)
+			continue;
+
+		ms = (callback->when.tv_sec - now.tv_sec) * 1000
+			+ (callback->when.tv_usec - now.tv_usec) / 1000;
+		if (ms <= 0)
+			return 0;
+		if (next_ms < 0 || ms < next_ms)
+			next_ms = ms;
+	}
+
+	return next_ms;
+}
+
+/* Working areas are kept as an address-ordered list which covers the whole
+ * working memory: allocation picks the smallest free area that fits and
+ * splits off the rest, freeing merges an area with its free neighbours.
+ * Areas holding an algorithm loaded through target_alloc_loader() stay
+ * allocated after they are freed, so the next user of the same code
+ * need not download it again; see target_invalidate_loaders().
+ */
+
+static void target_merge_working_areas(struct target *target)
 {
 	struct working_area *c = target->working_areas;
+
+	while (c && c->next)
+	{
+		struct working_area *next = c->next;
+
+		if (c->free && next->free)
+		{
+			c->size += next->size;
+			c->next = next->next;
+			free(next);
+			continue;
+		}
+		c = next;
+	}
+}
+
+/* release an idle resident algorithm */
+static void target_drop_loader(struct target *target, struct working_area *area)
+{
+	LOG_DEBUG("dropping resident algorithm at 0x%08x", (unsigned)area->address);
+
+	free(area->code);
+	area->code = NULL;
+	area->code_size = 0;
+	area->code_hash = 0;
+	area->free = true;
+
+	target_merge_working_areas(target);
+}
+
+static void target_drop_idle_loaders(struct target *target)
+{
+	struct working_area *c;
+
+restart:
+	for (c = target->working_areas; c; c = c->next)
+	{
+		if (c->code && !c->user)
+		{
+			/* merging may free list entries; start over */
+			target_drop_loader(target, c);
+			goto restart;
+		}
+	}
+}
+
+/**
+ * Forget resident algorithms overlapping memory that is being written
+ * from outside (a user or debugger write); areas in use are freed for
+ * real once their owner releases them.
+ */
+static void target_invalidate_loaders(struct target *target,
+		uint32_t address, uint32_t size)
+{
+	struct working_area *c;
+
+restart:
+	for (c = target->working_areas; c; c = c->next)
+	{
+		if (!c->code)
+			continue;
+		if (address >= c->address + c->size || address + size <= c->address)
+			continue;
+
+		if (!c->user)
+		{
+			target_drop_loader(target, c);
+			goto restart;
+		}
+
+		free(c->code);
+		c->code = NULL;
+		c->code_size = 0;
+		c->code_hash = 0;
+	}
+}
+
+/* FNV-1a, to make loader lookups cheap */
+static uint32_t target_loader_hash(const uint8_t *code, uint32_t size)
+{
+	uint32_t hash = 2166136261u;
+
+	while (size--)
+	{
+		hash ^= *code++;
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+int target_alloc_working_area_try(struct target *target, uint32_t size, struct working_area **area)
+{
+	struct working_area *c;
 	struct working_area *new_wa = NULL;
 
 	/* Reevaluate working area address based on MMU state*/
@@ -1182,6 +1821,16 @@ int target_alloc_working_area_try(struct target *target, uint32_t size, struct w
 				return ERROR_TARGET_RESOURCE_NOT_AVAILABLE;
 			}
 		}
+
+		/* start out with one free area spanning all of it */
+		new_wa = calloc(1, sizeof(struct working_area));
+		if (!new_wa)
+			return ERROR_FAIL;
+		new_wa->address = target->working_area;
+		new_wa->size = target->working_area_size;
+		new_wa->free = true;
+		target->working_areas = new_wa;
+		new_wa = NULL;
 	}
 
 	/* only allocate multiples of 4 byte */
@@ -1191,67 +1840,51 @@ int target_alloc_working_area_try(struct target *target, uint32_t size, struct w
 		size = (size + 3) & (~3);
 	}
 
-	/* see if there's already a matching working area */
-	while (c)
+	/* best fit:  the smallest free area that is large enough */
+	for (c = target->working_areas; c; c = c->next)
 	{
-		if ((c->free) && (c->size == size))
-		{
+		if (c->free && c->size >= size
+				&& (!new_wa || c->size < new_wa->size))
 			new_wa = c;
-			break;
-		}
-		c = c->next;
 	}
 
-	/* if not, allocate a new one */
+	/* make room by giving up resident algorithms nobody is using */
 	if (!new_wa)
 	{
-		struct working_area **p = &target->working_areas;
-		uint32_t first_free = target->working_area;
-		uint32_t free_size = target->working_area_size;
+		target_drop_idle_loaders(target);
 
-		c = target->working_areas;
-		while (c)
+		for (c = target->working_areas; c; c = c->next)
 		{
-			first_free += c->size;
-			free_size -= c->size;
-			p = &c->next;
-			c = c->next;
+			if (c->free && c->size >= size
+					&& (!new_wa || c->size < new_wa->size))
+				new_wa = c;
 		}
+	}
 
-		if (free_size < size)
-		{
-			return ERROR_TARGET_RESOURCE_NOT_AVAILABLE;
-		}
+	if (!new_wa)
+		return ERROR_TARGET_RESOURCE_NOT_AVAILABLE;
 
-		LOG_DEBUG("allocated new working area at address 0x%08x", (unsigned)first_free);
+	/* split off what is left over */
+	if (new_wa->size > size)
+	{
+		struct working_area *rest = calloc(1, sizeof(struct working_area));
+		if (!rest)
+			return ERROR_FAIL;
+		rest->address = new_wa->address + size;
+		rest->size = new_wa->size - size;
+		rest->free = true;
+		rest->next = new_wa->next;
 
-		new_wa = malloc(sizeof(struct working_area));
-		new_wa->next = NULL;
 		new_wa->size = size;
-		new_wa->address = first_free;
-
-		if (target->backup_working_area)
-		{
-			int retval;
-			new_wa->backup = malloc(new_wa->size);
-			if ((retval = target_read_memory(target, new_wa->address, 4, new_wa->size / 4, new_wa->backup)) != ERROR_OK)
-			{
-				free(new_wa->backup);
-				free(new_wa);
-				return retval;
-			}
-		}
-		else
-		{
-			new_wa->backup = NULL;
-		}
-
-		/* put new entry in list */
-		*p = new_wa;
+		new_wa->next = rest;
 	}
 
+	LOG_DEBUG("allocated working area of %u bytes at address 0x%08x",
+			(unsigned)size, (unsigned)new_wa->address);
+
 	/* mark as used, and return the new (reused) area */
 	new_wa->free = false;
+	new_wa->scratch = false;
 	*area = new_wa;
 
 	/* user pointer */
@@ -1273,30 +1906,105 @@ int target_alloc_working_area(struct target *target, uint32_t size, struct worki
 
 }
 
-static int target_free_working_area_restore(struct target *target, struct working_area *area, int restore)
+int target_alloc_loader(struct target *target, const uint8_t *code,
+		uint32_t size, struct working_area **area)
+{
+	uint32_t hash = target_loader_hash(code, size);
+	struct working_area *c;
+	uint8_t *readback;
+	int retval;
+
+	for (c = target->working_areas; c; c = c->next)
+	{
+		if (c->code && !c->user && c->code_hash == hash
+				&& c->code_size == size
+				&& memcmp(c->code, code, size) == 0)
+		{
+			LOG_DEBUG("reusing resident algorithm at 0x%08x",
+					(unsigned)c->address);
+			c->user = area;
+			*area = c;
+			return ERROR_OK;
+		}
+	}
+
+	retval = target_alloc_working_area(target, (size + 3) & ~3, area);
+	if (retval != ERROR_OK)
+		return retval;
+
+	retval = target_write_buffer(target, (*area)->address, size, code);
+	if (retval != ERROR_OK)
+	{
+		target_free_working_area(target, *area);
+		return retval;
+	}
+
+	/* keeping it resident would leave the backed up memory clobbered */
+	if (target->backup_working_area)
+		return ERROR_OK;
+
+	/* only cache what is known to have arrived intact */
+	readback = malloc(size);
+	if (!readback)
+		return ERROR_OK;
+	retval = target_read_buffer(target, (*area)->address, size, readback);
+	if (retval != ERROR_OK || memcmp(readback, code, size) != 0)
+	{
+		LOG_WARNING("algorithm at 0x%08x does not read back as written",
+				(unsigned)(*area)->address);
+		free(readback);
+		return ERROR_OK;
+	}
+
+	/* the readback buffer becomes the cached copy */
+	(*area)->code = readback;
+	(*area)->code_size = size;
+	(*area)->code_hash = hash;
+
+	return ERROR_OK;
+}
+
+uint32_t target_get_working_area_avail(struct target *target)
+{
+	struct working_area *c;
+	uint32_t max_size = 0;
+
+	if (target->working_areas == NULL)
+		return target->working_area_size;
+
+	for (c = target->working_areas; c; c = c->next)
+	{
+		if (c->free && c->size > max_size)
+			max_size = c->size;
+	}
+
+	return max_size;
+}
+
+int target_free_working_area(struct target *target, struct working_area *area)
 {
 	if (area->free)
 		return ERROR_OK;
 
-	if (restore && target->backup_working_area)
+	/* a resident algorithm just loses its user */
+	if (area->code)
 	{
-		int retval;
-		if ((retval = target_write_memory(target, area->address, 4, area->size / 4, area->backup)) != ERROR_OK)
-			return retval;
+		if (area->user)
+			*area->user = NULL;
+		area->user = NULL;
+		return ERROR_OK;
 	}
 
+	/* any backup stays around until target_restore_working_memory() */
 	area->free = true;
 
 	/* mark user pointer invalid */
 	*area->user = NULL;
 	area->user = NULL;
 
-	return ERROR_OK;
-}
+	target_merge_working_areas(target);
 
-int target_free_working_area(struct target *target, struct working_area *area)
-{
-	return target_free_working_area_restore(target, area, 1);
+	return ERROR_OK;
 }
 
 /* free resources and restore memory, if restoring memory fails,
@@ -1306,14 +2014,22 @@ static void target_free_all_working_areas_restore(struct target *target, int res
 {
 	struct working_area *c = target->working_areas;
 
+	if (restore)
+		target_restore_working_memory(target);
+
+	free(target->working_area_backup);
+	target->working_area_backup = NULL;
+	free(target->working_area_saved);
+	target->working_area_saved = NULL;
+
 	while (c)
 	{
 		struct working_area *next = c->next;
-		target_free_working_area_restore(target, c, restore);
 
-		if (c->backup)
-			free(c->backup);
+		if (c->user)
+			*c->user = NULL;
 
+		free(c->code);
 		free(c);
 
 		c = next;
@@ -1351,6 +2067,8 @@ int target_arch_state(struct target *target)
  */
 int target_write_buffer(struct target *target, uint32_t address, uint32_t size, const uint8_t *buffer)
 {
+	int retval;
+
 	LOG_DEBUG("writing buffer of %i byte at 0x%8.8x",
 		  (int)size, (unsigned)address);
 
@@ -1373,6 +2091,12 @@ int target_write_buffer(struct target *target, uint32_t address, uint32_t size,
 		return ERROR_FAIL;
 	}
 
+	retval = target_backup_access(target, address, size, true);
+	if (retval != ERROR_OK)
+		return retval;
+	target_invalidate_loaders(target, address, size);
+	if (target->rtos)
+		rtos_cache_invalidate(target->rtos);
 	return target->type->write_buffer(target, address, size, buffer);
 }
 
@@ -1439,6 +2163,8 @@ static int target_write_buffer_default(struct target *target, uint32_t address,
  */
 int target_read_buffer(struct target *target, uint32_t address, uint32_t size, uint8_t *buffer)
 {
+	int retval;
+
 	LOG_DEBUG("reading buffer of %i byte at 0x%8.8x",
 			  (int)size, (unsigned)address);
 
@@ -1461,6 +2187,9 @@ int target_read_buffer(struct target *target, uint32_t address, uint32_t size, u
 		return ERROR_FAIL;
 	}
 
+	retval = target_backup_access(target, address, size, false);
+	if (retval != ERROR_OK)
+		return retval;
 	return target->type->read_buffer(target, address, size, buffer);
 }
 
@@ -3095,7 +3824,8 @@ static void writeString(FILE *f, char *s)
 }
 
 /* Dump a gmon.out histogram file. */
-static void writeGmon(uint32_t *samples, uint32_t sampleNum, const char *filename)
+static void writeGmon(uint32_t *samples, uint32_t sampleNum, const char *filename,
+		uint32_t sample_rate)
 {
 	uint32_t i;
 	FILE *f = fopen(filename, "w");
@@ -3154,7 +3884,7 @@ static void writeGmon(uint32_t *samples, uint32_t sampleNum, const char *filenam
 	writeLong(f, min); 			/* low_pc */
 	writeLong(f, max);			/* high_pc */
 	writeLong(f, length);		/* # of samples */
-	writeLong(f, 100); 			/* KLUDGE! We lie, ca. 100Hz best case. */
+	writeLong(f, sample_rate);	/* measured, not a fixed clock */
 	writeString(f, "seconds");
 	for (i = 0; i < (15-strlen("seconds")); i++)
 		writeData(f, &zero, 1);
@@ -3187,48 +3917,48 @@ static void writeGmon(uint32_t *samples, uint32_t sampleNum, const char *filenam
 	fclose(f);
 }
 
-/* profiling samples the CPU PC as quickly as OpenOCD is able,
- * which will be used as a random sampling of PC */
-COMMAND_HANDLER(handle_profile_command)
+int target_profile_add_sample(struct target_profile *profile, uint32_t pc)
 {
-	struct target *target = get_current_target(CMD_CTX);
-	struct timeval timeout, now;
-
-	gettimeofday(&timeout, NULL);
-	if (CMD_ARGC != 2)
+	if (profile->num_samples == profile->size)
 	{
-		return ERROR_COMMAND_SYNTAX_ERROR;
+		uint32_t size = profile->size ? profile->size * 2 : 4096;
+		uint32_t *samples = realloc(profile->samples, sizeof(uint32_t) * size);
+		if (samples == NULL)
+		{
+			LOG_ERROR("out of memory after %" PRIu32 " samples",
+					profile->num_samples);
+			return ERROR_FAIL;
+		}
+		profile->samples = samples;
+		profile->size = size;
 	}
-	unsigned offset;
-	COMMAND_PARSE_NUMBER(uint, CMD_ARGV[0], offset);
 
-	timeval_add_time(&timeout, offset, 0);
+	profile->samples[profile->num_samples++] = pc;
 
-	/**
-	 * @todo: Some cores let us sample the PC without the
-	 * annoying halt/resume step; for example, ARMv7 PCSR.
-	 * Provide a way to use that more efficient mechanism.
-	 */
+	return ERROR_OK;
+}
 
-	command_print(CMD_CTX, "Starting profiling. Halting and resuming the target as often as we can...");
+int target_profiling_default(struct target *target,
+		struct target_profile *profile, uint32_t seconds)
+{
+	struct timeval timeout, now;
+	int retval = ERROR_OK;
 
-	static const int maxSample = 10000;
-	uint32_t *samples = malloc(sizeof(uint32_t)*maxSample);
-	if (samples == NULL)
-		return ERROR_OK;
+	gettimeofday(&timeout, NULL);
+	timeval_add_time(&timeout, seconds, 0);
 
-	int numSamples = 0;
 	/* hopefully it is safe to cache! We want to stop/restart as quickly as possible. */
 	struct reg *reg = register_get_by_name(target->reg_cache, "pc", 1);
 
 	for (;;)
 	{
-		int retval;
 		target_poll(target);
 		if (target->state == TARGET_HALTED)
 		{
 			uint32_t t=*((uint32_t *)reg->value);
-			samples[numSamples++]=t;
+			retval = target_profile_add_sample(profile, t);
+			if (retval != ERROR_OK)
+				break;
 			retval = target_resume(target, 1, 0, 0, 0); /* current pc, addr = 0, do not handle breakpoints, not debugging */
 			target_poll(target);
 			alive_sleep(10); /* sleep 10ms, i.e. <100 samples/second. */
@@ -3236,45 +3966,82 @@ COMMAND_HANDLER(handle_profile_command)
 		{
 			/* We want to quickly sample the PC. */
 			if ((retval = target_halt(target)) != ERROR_OK)
-			{
-				free(samples);
 				return retval;
-			}
 		} else
 		{
-			command_print(CMD_CTX, "Target not halted or running");
-			retval = ERROR_OK;
-			break;
+			LOG_ERROR("Target not halted or running");
+			return ERROR_OK;
 		}
 		if (retval != ERROR_OK)
-		{
 			break;
-		}
 
 		gettimeofday(&now, NULL);
-		if ((numSamples >= maxSample) || ((now.tv_sec >= timeout.tv_sec) && (now.tv_usec >= timeout.tv_usec)))
-		{
-			command_print(CMD_CTX, "Profiling completed. %d samples.", numSamples);
-			if ((retval = target_poll(target)) != ERROR_OK)
-			{
-				free(samples);
-				return retval;
-			}
-			if (target->state == TARGET_HALTED)
-			{
-				target_resume(target, 1, 0, 0, 0); /* current pc, addr = 0, do not handle breakpoints, not debugging */
-			}
-			if ((retval = target_poll(target)) != ERROR_OK)
-			{
-				free(samples);
-				return retval;
-			}
-			writeGmon(samples, numSamples, CMD_ARGV[1]);
-			command_print(CMD_CTX, "Wrote %s", CMD_ARGV[1]);
+		if ((now.tv_sec > timeout.tv_sec)
+			|| ((now.tv_sec == timeout.tv_sec) && (now.tv_usec >= timeout.tv_usec)))
 			break;
-		}
 	}
-	free(samples);
+
+	return retval;
+}
+
+/* profiling samples the CPU PC as quickly as OpenOCD is able,
+ * which will be used as a random sampling of PC */
+COMMAND_HANDLER(handle_profile_command)
+{
+	struct target *target = get_current_target(CMD_CTX);
+	struct target_profile profile = { .samples = NULL };
+	int64_t start;
+	int retval;
+
+	if (CMD_ARGC != 2)
+	{
+		return ERROR_COMMAND_SYNTAX_ERROR;
+	}
+	unsigned offset;
+	COMMAND_PARSE_NUMBER(uint, CMD_ARGV[0], offset);
+
+	start = timeval_ms();
+	if (target->type->profiling)
+	{
+		command_print(CMD_CTX, "Starting profiling. Sampling the PC while the target runs...");
+		retval = target->type->profiling(target, &profile, offset);
+	} else
+	{
+		command_print(CMD_CTX, "Starting profiling. Halting and resuming the target as often as we can...");
+		retval = target_profiling_default(target, &profile, offset);
+	}
+	if (retval != ERROR_OK)
+	{
+		free(profile.samples);
+		return retval;
+	}
+
+	command_print(CMD_CTX, "Profiling completed. %" PRIu32 " samples.", profile.num_samples);
+
+	if ((retval = target_poll(target)) != ERROR_OK)
+	{
+		free(profile.samples);
+		return retval;
+	}
+	if (target->state == TARGET_HALTED)
+	{
+		target_resume(target, 1, 0, 0, 0); /* current pc, addr = 0, do not handle breakpoints, not debugging */
+	}
+	if ((retval = target_poll(target)) != ERROR_OK)
+	{
+		free(profile.samples);
+		return retval;
+	}
+
+	if (profile.num_samples > 0)
+	{
+		int64_t elapsed = timeval_ms() - start;
+		uint32_t rate = elapsed > 0 ? (profile.num_samples * 1000LL) / elapsed : 0;
+
+		writeGmon(profile.samples, profile.num_samples, CMD_ARGV[1], rate ? rate : 1);
+		command_print(CMD_CTX, "Wrote %s", CMD_ARGV[1]);
+	}
+	free(profile.samples);
 
 	return ERROR_OK;
 }
@@ -101,9 +101,17 @@ struct working_area
 	uint32_t address;
 	uint32_t size;
 	bool free;
-	uint8_t *backup;
+	/* set by the owner when algorithms only write bytes the host wrote
+	 * first, so a working area backup need not cover the rest
+	 */
+	bool scratch;
 	struct working_area **user;
 	struct working_area *next;
+
+	/* resident algorithm, see target_alloc_loader() */
+	uint8_t *code;
+	uint32_t code_size;
+	uint32_t code_hash;
 };
  
 struct gdb_service
@@ -155,6 +163,8 @@ struct target
 	uint32_t working_area_size;			/* size in bytes */
 	uint32_t backup_working_area;			/* whether the content of the working area has to be preserved */
 	struct working_area *working_areas;/* list of allocated working areas */
+	uint8_t *working_area_backup;		/* saved working memory content */
+	uint32_t *working_area_saved;		/* bitmap of the words saved there */
 	enum target_debug_reason debug_reason;/* reason why the target entered debug state */
 	enum target_endianness endianness;	/* target endianness */
 	// also see: target_state_name()
@@ -321,6 +331,7 @@ int target_call_event_callbacks(struct target *target, enum target_event event);
  */
 int target_register_timer_callback(int (*callback)(void *priv),
 		int time_ms, int periodic, void *priv);
+int target_unregister_timer_callback(int (*callback)(void *priv), void *priv);
 
 int target_call_timer_callbacks(void);
 /**
@@ -328,6 +339,32 @@ int target_call_timer_callbacks(void);
  * a syncrhonous command completes.
  */
 int target_call_timer_callbacks_now(void);
+/**
+ * Returns the number of milliseconds until the next timer callback is
+ * due, 0 if one is already overdue, or -1 if none are registered.  Used
+ * by the server loop to size its sleep rather than waking up on a fixed
+ * period.
+ */
+int target_timer_callbacks_next_ms(void);
+
+/**
+ * PC samples gathered by the profile command.  The buffer grows as
+ * samples come in, there is no fixed upper limit.
+ */
+struct target_profile
+{
+	uint32_t *samples;
+	uint32_t num_samples;
+	uint32_t size;
+};
+
+int target_profile_add_sample(struct target_profile *profile, uint32_t pc);
+/**
+ * Sample the PC by halting and resuming the target, for targets that
+ * can't do it non-intrusively.
+ */
+int target_profiling_default(struct target *target,
+		struct target_profile *profile, uint32_t seconds);
 
 struct target* get_current_target(struct command_context *cmd_ctx);
 struct target *get_target(const char *id);
@@ -416,6 +453,47 @@ int target_run_algorithm(struct target *target,
 		uint32_t entry_point, uint32_t exit_point,
 		int timeout_ms, void *arch_info);
 
+/**
+ * Start an algorithm on the @a target given, without waiting for it.
+ *
+ * This routine is a wrapper for target->type->start_algorithm.
+ */
+int target_start_algorithm(struct target *target,
+		int num_mem_params, struct mem_param *mem_params,
+		int num_reg_params, struct reg_param *reg_params,
+		uint32_t entry_point, uint32_t exit_point,
+		void *arch_info);
+
+/**
+ * Wait for an algorithm started by target_start_algorithm() to finish.
+ *
+ * This routine is a wrapper for target->type->wait_algorithm.
+ */
+int target_wait_algorithm(struct target *target,
+		int num_mem_params, struct mem_param *mem_params,
+		int num_reg_params, struct reg_param *reg_params,
+		uint32_t exit_point, int timeout_ms,
+		void *arch_info);
+
+/**
+ * Stream @a count blocks of @a block_size bytes from @a buffer to an
+ * algorithm running on the @a target, through a FIFO in target memory.
+ *
+ * The FIFO occupies @a buffer_size bytes at @a buffer_start: a write
+ * pointer word (advanced by the host; 0 tells the algorithm to stop),
+ * a read pointer word (advanced by the algorithm; 0 reports failure),
+ * then the data area.  Both pointers hold target addresses inside the
+ * data area.  The algorithm is started with the given parameters and
+ * keeps consuming blocks while the host keeps filling the FIFO.
+ */
+int target_run_flash_async_algorithm(struct target *target,
+		const uint8_t *buffer, uint32_t count, int block_size,
+		int num_mem_params, struct mem_param *mem_params,
+		int num_reg_params, struct reg_param *reg_params,
+		uint32_t buffer_start, uint32_t buffer_size,
+		uint32_t entry_point, uint32_t exit_point,
+		void *arch_info);
+
 /**
  * Read @a count items of @a size bytes from the memory of @a target at
  * the @a address given.
@@ -515,6 +593,30 @@ int target_alloc_working_area_try(struct target *target,
 int target_free_working_area(struct target *target, struct working_area *area);
 void target_free_all_working_areas(struct target *target);
 
+/* Write back working memory saved because of -work-area-backup.  This
+ * happens by itself when the target resumes or steps, when working areas
+ * are reset, when gdb detaches and when OpenOCD shuts down.
+ */
+int target_restore_working_memory(struct target *target);
+
+/* Leave all targets the way the application expects to find them. */
+void target_quit(void);
+
+/* Allocate a working area holding the algorithm @a code.  Unless working
+ * areas are backed up, the algorithm stays resident after
+ * target_free_working_area(), and a later call with the same code gets
+ * it back without another download.  Resident algorithms are given up
+ * when the working areas are reset (target reset or resume, see
+ * target_free_all_working_areas()), when memory over them is written
+ * through target_write_memory() and friends, or when their space is
+ * needed for another allocation.
+ */
+int target_alloc_loader(struct target *target, const uint8_t *code,
+		uint32_t size, struct working_area **area);
+
+/* Size of the largest working area that could be allocated right now. */
+uint32_t target_get_working_area_avail(struct target *target);
+
 extern struct target *all_targets;
 
 uint32_t target_buffer_get_u32(struct target *target, const uint8_t *buffer);
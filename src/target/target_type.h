@@ -30,6 +30,7 @@
 #include <jim-nvp.h>
 
 struct target;
+struct target_profile;
 
 /**
  * This holds methods shared between all instances of a given target
@@ -169,6 +170,14 @@ struct target_type
 	 * use target_run_algorithm() instead.
 	 */
 	int (*run_algorithm)(struct target *target, int num_mem_params, struct mem_param *mem_params, int num_reg_params, struct reg_param *reg_param, uint32_t entry_point, uint32_t exit_point, int timeout_ms, void *arch_info);
+	/**
+	 * Start an algorithm and return while it runs; wait_algorithm()
+	 * then collects its results.  Optional.  Do @b not call these
+	 * methods directly, use target_start_algorithm() and
+	 * target_wait_algorithm() instead.
+	 */
+	int (*start_algorithm)(struct target *target, int num_mem_params, struct mem_param *mem_params, int num_reg_params, struct reg_param *reg_param, uint32_t entry_point, uint32_t exit_point, void *arch_info);
+	int (*wait_algorithm)(struct target *target, int num_mem_params, struct mem_param *mem_params, int num_reg_params, struct reg_param *reg_param, uint32_t exit_point, int timeout_ms, void *arch_info);
 
 	const struct command_registration *commands;
 
@@ -236,6 +245,15 @@ struct target_type
 	 * circumstances.
 	 */
 	int (*check_reset)(struct target *target);
+
+	/**
+	 * Collect PC samples for @a seconds without stopping the core,
+	 * e.g. from a PC sample register.  Optional; the profile command
+	 * falls back to target_profiling_default(), which halts and
+	 * resumes the target for every sample.
+	 */
+	int (*profiling)(struct target *target, struct target_profile *profile,
+			uint32_t seconds);
 };
 
 #endif // TARGET_TYPE_H
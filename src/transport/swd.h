@@ -49,6 +49,35 @@
 #include <helper/log.h>
 #include <interface/interface.h>
 #include <jtag/interface.h>
+#include <transport/swd_libswd_drv_openocd.h>
+
+#ifdef _DEBUG_SWD_IO_
+#define DEBUG_SWD_IO(expr ...) \
+	do { if (1) LOG_DEBUG(expr); } while (0)
+#else
+#define DEBUG_SWD_IO(expr ...) \
+	do { if (0) LOG_DEBUG(expr); } while (0)
+#endif
+
+/** Location of queued read data phase and where to store it on run(). */
+struct oocd_swd_read {
+	int *src;
+	uint32_t *dst;
+};
+
+/** Deferred read bookkeeping of the SWD transport, one per DAP. */
+struct oocd_swd_queue {
+	/** Reads enqueued since last run(), in queue order. */
+	struct oocd_swd_read *reads;
+	int reads_count;
+	int reads_size;
+	/** Destination of the last AP read still waiting for its data phase. */
+	uint32_t *posted;
+	bool posted_pending;
+	/** DAP owning this queue, and the next queue allocated by the transport. */
+	struct adiv5_dap *dap;
+	struct oocd_swd_queue *next;
+};
 
 int oocd_swd_queue_idcode_read(struct adiv5_dap *dap, uint8_t *ack, uint32_t *data);
 int oocd_swd_queue_dp_read(struct adiv5_dap *dap, unsigned reg, uint32_t *data);
@@ -59,6 +88,7 @@ int oocd_swd_queue_ap_abort(struct adiv5_dap *dap, uint8_t *ack);
 int oocd_swd_run(struct adiv5_dap *dap);
 int oocd_swd_transport_init(struct command_context *ctx);
 int oocd_swd_transport_select(struct command_context *ctx);
+int oocd_swd_transport_quit(void);
 
 extern struct transport oocd_transport_swd;
 extern const struct dap_ops oocd_dap_ops_swd;
@@ -49,7 +49,78 @@ extern struct jtag_interface *jtag_interface;
 
 /** @{ swd_arm_adi_v5 Function set to support existing ARM ADI v5 target's
  * infrastructure.
+ *
+ * Reads are only enqueued into LibSWD queue, together with the location of
+ * the queued data phase and the caller's destination pointer. Results are
+ * copied to their destinations by oocd_swd_run() after the whole queue was
+ * flushed with one transaction, as upper layers expect from dap_ops.
+ *
+ * AP reads on SW-DP are posted: data phase of an AP read returns the result
+ * of the previous AP read. Back-to-back AP reads are therefore chained, so
+ * the data phase of each read delivers the previous result, and the last
+ * result is fetched with a single RDBUFF read before any other operation.
+ */
+
+/** Queues allocated so far, released by oocd_swd_transport_quit(). */
+static struct oocd_swd_queue *oocd_swd_queues;
+
+/**
+ * Get deferred read bookkeeping of the DAP, allocating it on first use.
+ * \return pointer to the queue, or NULL on allocation failure.
+ */
+static struct oocd_swd_queue *oocd_swd_queue_get(struct adiv5_dap *dap){
+	if (dap->swd_queue==NULL){
+		dap->swd_queue=calloc(1, sizeof(struct oocd_swd_queue));
+		if (dap->swd_queue==NULL){
+			LOG_ERROR("Cannot allocate SWD read queue!");
+			return NULL;
+		}
+		dap->swd_queue->dap=dap;
+		dap->swd_queue->next=oocd_swd_queues;
+		oocd_swd_queues=dap->swd_queue;
+	}
+	return dap->swd_queue;
+}
+
+/**
+ * Remember that data phase found at \a src will land in \a dst on run().
+ * \return ERROR_OK on success, ERROR_FAIL on allocation failure.
  */
+static int oocd_swd_queue_add_read(struct oocd_swd_queue *q, int *src, uint32_t *dst){
+	struct oocd_swd_read *reads;
+	if (dst==NULL) return ERROR_OK;
+	if (q->reads_count==q->reads_size){
+		int size=q->reads_size?(2*q->reads_size):64;
+		reads=realloc(q->reads, size*sizeof(struct oocd_swd_read));
+		if (reads==NULL){
+			LOG_ERROR("Cannot grow SWD read queue to %d elements!", size);
+			return ERROR_FAIL;
+		}
+		q->reads=reads;
+		q->reads_size=size;
+	}
+	q->reads[q->reads_count].src=src;
+	q->reads[q->reads_count].dst=dst;
+	q->reads_count++;
+	return ERROR_OK;
+}
+
+/**
+ * Terminate chain of posted AP reads with RDBUFF read that returns the
+ * result of the last AP read. Must be called before any other operation.
+ * \return ERROR_OK on success, ERROR_FAIL on failure.
+ */
+static int oocd_swd_queue_posted_close(struct adiv5_dap *dap, struct oocd_swd_queue *q){
+	int retval, *rdata;
+	if (!q->posted_pending) return ERROR_OK;
+	q->posted_pending=false;
+	retval=swd_dp_read((swd_ctx_t *)dap->ctx, SWD_OPERATION_ENQUEUE, DP_RDBUFF, &rdata);
+	if (retval<0){
+		LOG_ERROR("swd_dp_read(RDBUFF) error: %s ", swd_error_string(retval));
+		return ERROR_FAIL;
+	}
+	return oocd_swd_queue_add_read(q, rdata, q->posted);
+}
 
 int oocd_swd_queue_idcode_read(struct adiv5_dap *dap, uint8_t *ack, uint32_t *data){
 	int retval;
@@ -62,17 +133,24 @@ int oocd_swd_queue_idcode_read(struct adiv5_dap *dap, uint8_t *ack, uint32_t *da
 
 int oocd_swd_queue_dp_read(struct adiv5_dap *dap, unsigned reg, uint32_t *data){
 	int retval, *rdata;
-	retval=swd_dp_read((swd_ctx_t *)dap->ctx, SWD_OPERATION_EXECUTE, reg, &rdata);
+	struct oocd_swd_queue *q=oocd_swd_queue_get(dap);
+	if (q==NULL) return ERROR_FAIL;
+	retval=oocd_swd_queue_posted_close(dap, q);
+	if (retval!=ERROR_OK) return retval;
+	retval=swd_dp_read((swd_ctx_t *)dap->ctx, SWD_OPERATION_ENQUEUE, reg, &rdata);
 	if (retval<0){
 		LOG_ERROR("swd_dp_read() error: %s ", swd_error_string(retval));
 		return ERROR_FAIL;
 	}
-	if (data!=NULL) *data=(uint32_t)*rdata;
-	return ERROR_OK;
+	return oocd_swd_queue_add_read(q, rdata, data);
 }
 
 int oocd_swd_queue_dp_write(struct adiv5_dap *dap, unsigned reg, uint32_t data){
 	int retval;
+	struct oocd_swd_queue *q=oocd_swd_queue_get(dap);
+	if (q==NULL) return ERROR_FAIL;
+	retval=oocd_swd_queue_posted_close(dap, q);
+	if (retval!=ERROR_OK) return retval;
 	retval=swd_dp_write((swd_ctx_t *)dap->ctx, SWD_OPERATION_ENQUEUE, (char) reg, (int *) &data);
 	if (retval<0){
 		LOG_ERROR("swd_dp_write() error: %s ", swd_error_string(retval));
@@ -83,17 +161,29 @@ int oocd_swd_queue_dp_write(struct adiv5_dap *dap, unsigned reg, uint32_t data){
 
 int oocd_swd_queue_ap_read(struct adiv5_dap *dap, unsigned reg, uint32_t *data){
 	int retval, *rdata;
-	retval=swd_ap_read((swd_ctx_t *)dap->ctx, SWD_OPERATION_EXECUTE, (char) reg, &rdata);
+	struct oocd_swd_queue *q=oocd_swd_queue_get(dap);
+	if (q==NULL) return ERROR_FAIL;
+	retval=swd_ap_read((swd_ctx_t *)dap->ctx, SWD_OPERATION_ENQUEUE, (char) reg, &rdata);
 	if (retval<0){
 		LOG_ERROR("swd_ap_read() error: %s ", swd_error_string(retval));
 		return ERROR_FAIL;
 	}
-	if (data!=NULL) *data=*rdata;
+	/* Data phase of this read carries the result of the previous posted one. */
+	if (q->posted_pending){
+		retval=oocd_swd_queue_add_read(q, rdata, q->posted);
+		if (retval!=ERROR_OK) return retval;
+	}
+	q->posted=data;
+	q->posted_pending=true;
 	return ERROR_OK;
 }
 
 int oocd_swd_queue_ap_write(struct adiv5_dap *dap, unsigned reg, uint32_t data){
 	int retval;
+	struct oocd_swd_queue *q=oocd_swd_queue_get(dap);
+	if (q==NULL) return ERROR_FAIL;
+	retval=oocd_swd_queue_posted_close(dap, q);
+	if (retval!=ERROR_OK) return retval;
 	retval=swd_ap_write((swd_ctx_t *)dap->ctx, SWD_OPERATION_ENQUEUE, (char) reg, (int *) &data);
 	if (retval<0){
 		LOG_ERROR("swd_ap_write() error: %s ", swd_error_string(retval));
@@ -106,21 +196,66 @@ int oocd_swd_queue_ap_abort(struct adiv5_dap *dap, uint8_t *ack){
 	int retval;
 	int abort_flags = SWD_DP_ABORT_ORUNERRCLR | SWD_DP_ABORT_WDERRCLR | SWD_DP_ABORT_STKERRCLR \
 					| SWD_DP_ABORT_STKCMPCLR | SWD_DP_ABORT_DAPABORT;
+	/* Aborted transactions will not deliver any data, forget about them. */
+	if (dap->swd_queue){
+		dap->swd_queue->posted_pending=false;
+		dap->swd_queue->reads_count=0;
+	}
 	retval=swd_dp_write((swd_ctx_t *)dap->ctx, SWD_OPERATION_EXECUTE, SWD_DP_ABORT_ADDR, &abort_flags);
 	if (retval<0){
 		LOG_ERROR("swd_dp_write(ABORT) error: %s ", swd_error_string(retval));
 		return ERROR_FAIL;
 	}
-	return ERROR_OK;
+	return oocd_interface_transfer_flush(jtag_interface, NULL);
 }
 
+/**
+ * Flush the queue with idle cycles adapted to the selected AP, and report
+ * the outcome to the DAP WAIT handling (see dap_wait_account()).
+ * \return ERROR_OK on success, ERROR_DAP_WAIT or ERROR_DAP_FAULT when the
+ *  target answered so, ERROR_FAIL on other failures.
+ */
 int oocd_swd_run(struct adiv5_dap *dap){
-	int retval;
+	int retval, i;
+	struct adiv5_ap_wait *wait;
+	struct oocd_swd_queue *q=oocd_swd_queue_get(dap);
+	if (q==NULL) return ERROR_FAIL;
+	retval=oocd_swd_queue_posted_close(dap, q);
+	if (retval!=ERROR_OK) return retval;
+	wait=dap_ap_wait(dap);
+	if (wait!=NULL) swd_drv_idle_cycles((swd_ctx_t *)dap->ctx, wait->idle_cycles);
 	retval=swd_cmdq_flush((swd_ctx_t *)dap->ctx, SWD_OPERATION_EXECUTE);
-	if (retval<0){
-		LOG_ERROR("swd_cmdq_flush() error: %s", swd_error_string(retval));
+	switch (retval){
+		case SWD_ERROR_ACK_WAIT:
+			/* Expected on a busy AP, retried by the caller. */
+			LOG_DEBUG("swd_cmdq_flush() error: %s", swd_error_string(retval));
+			retval=ERROR_DAP_WAIT;
+			break;
+		case SWD_ERROR_ACK_FAULT:
+			LOG_ERROR("swd_cmdq_flush() error: %s", swd_error_string(retval));
+			retval=ERROR_DAP_FAULT;
+			break;
+		default:
+			if (retval<0){
+				LOG_ERROR("swd_cmdq_flush() error: %s", swd_error_string(retval));
+				retval=ERROR_FAIL;
+			} else retval=ERROR_OK;
+	}
+	/* Trailing write-only phases may still sit in the adapter driver. */
+	i=oocd_interface_transfer_flush(jtag_interface, NULL);
+	if (i!=ERROR_OK && retval==ERROR_OK){
+		LOG_ERROR("cannot flush pending interface transfers");
+		retval=ERROR_FAIL;
+	}
+	dap_wait_account(dap, retval);
+	if (retval!=ERROR_OK){
+		q->reads_count=0;
 		return retval;
-	} else return ERROR_OK;
+	}
+	/* Whole queue went through the wire, deliver read results now. */
+	for (i=0;i<q->reads_count;i++) *q->reads[i].dst=(uint32_t)*q->reads[i].src;
+	q->reads_count=0;
+	return ERROR_OK;
 }
 
 
@@ -145,6 +280,12 @@ int oocd_swd_transport_init(struct command_context *ctx){
 			return ERROR_FAIL;
 		}
 		LOG_INFO("New SWD context initialized at 0x%p", (void *)dap->ctx);
+		/* Bind driver bridge of this context to the selected interface. */
+		retval=swd_drv_init((swd_ctx_t *)dap->ctx, jtag_interface);
+		if (retval<0){
+			LOG_ERROR("Unable to attach driver bridge: %s", swd_error_string(retval));
+			return ERROR_FAIL;
+		}
 		/* Now inherit the log level from OpenOCD settings. */
 		retval=swd_log_level_inherit((swd_ctx_t *)dap->ctx, debug_level);
 		if (retval<0){
@@ -193,10 +334,27 @@ int oocd_swd_transport_select(struct command_context *ctx){
 }
 
 
+/**
+ * Release the deferred read queues of all DAPs used with SWD transport.
+ * Called once on exit, when no more DAP operations take place.
+ */
+int oocd_swd_transport_quit(void){
+	struct oocd_swd_queue *q;
+	while (oocd_swd_queues){
+		q=oocd_swd_queues;
+		oocd_swd_queues=q->next;
+		q->dap->swd_queue=NULL;
+		free(q->reads);
+		free(q);
+	}
+	return ERROR_OK;
+}
+
 struct transport oocd_transport_swd = {
      .name = "swd",
      .select = oocd_swd_transport_select,
      .init = oocd_swd_transport_init,
+     .quit = oocd_swd_transport_quit,
      .ctx = NULL,
      .next = NULL,
 };
@@ -211,6 +369,7 @@ const struct dap_ops oocd_dap_ops_swd = {
 	.queue_ap_write = oocd_swd_queue_ap_write,
 	.queue_ap_abort = oocd_swd_queue_ap_abort,
 	.run = oocd_swd_run,
+	.mem_ap_read_buf_u32 = mem_ap_read_buf_u32_swd,
 };
 
 
@@ -42,7 +42,64 @@
 extern struct jtag_interface *jtag_interface;
 
 /**
- * Use UrJTAG's driver to write 8-bit data (char type).
+ * Attach bridge state to the SWD context, so all driver calls made on behalf
+ * of this context go to the given interface.
+ * \param *swdctx swd context to work on.
+ * \param *interface is the interface driver, NULL selects global jtag_interface.
+ * \return SWD_OK on success, or negative SWD_ERROR code on failure.
+ */
+int swd_drv_init(swd_ctx_t *swdctx, struct jtag_interface *interface){
+ struct swd_drv_openocd *drv;
+ if (swdctx==NULL) return SWD_ERROR_NULLCONTEXT;
+ if (swdctx->driver==NULL) return SWD_ERROR_NULLPOINTER;
+
+ drv=swdctx->driver->device;
+ if (drv==NULL){
+  drv=calloc(1, sizeof(struct swd_drv_openocd));
+  if (drv==NULL) return SWD_ERROR_NULLPOINTER;
+  swdctx->driver->device=drv;
+ }
+ drv->interface=interface?interface:jtag_interface;
+ return SWD_OK;
+}
+
+/** Get interface driver serving given context, global one if not attached. */
+static inline struct jtag_interface *swd_drv_interface(swd_ctx_t *swdctx){
+ struct swd_drv_openocd *drv;
+ if (swdctx==NULL || swdctx->driver==NULL) return jtag_interface;
+ drv=swdctx->driver->device;
+ return (drv && drv->interface)?drv->interface:jtag_interface;
+}
+
+/**
+ * Set number of idle clocks (SWDIO low) sent ahead of each request header,
+ * which gives the AP time to finish the previous transfer instead of
+ * answering WAIT to the next one.
+ * \param *swdctx swd context to work on.
+ * \param cycles is the number of idle clocks, 0 disables them.
+ * \return SWD_OK on success, or negative SWD_ERROR code on failure.
+ */
+int swd_drv_idle_cycles(swd_ctx_t *swdctx, int cycles){
+ struct swd_drv_openocd *drv;
+ if (swdctx==NULL) return SWD_ERROR_NULLCONTEXT;
+ if (swdctx->driver==NULL || swdctx->driver->device==NULL) return SWD_ERROR_NULLPOINTER;
+ if (cycles<0 || cycles>SWD_DRV_IDLE_CYCLES_MAX) return SWD_ERROR_PARAM;
+ drv=swdctx->driver->device;
+ drv->idle_cycles=cycles;
+ return SWD_OK;
+}
+
+/** Clock idle cycles requested for this context, if any. */
+static int swd_drv_idle(swd_ctx_t *swdctx, struct jtag_interface *interface){
+ struct swd_drv_openocd *drv=swdctx->driver->device;
+ uint8_t idle[SWD_DRV_IDLE_CYCLES_MAX/8+1];
+ if (drv==NULL || drv->idle_cycles==0) return 0;
+ memset(idle, 0, sizeof(idle));
+ return oocd_interface_transfer_bits(interface, NULL, drv->idle_cycles, idle, NULL, 0, SWD_DIR_LSBFIRST);
+}
+
+/**
+ * Use OpenOCD's driver to write 8-bit data (char type).
  * MOSI (Master Output Slave Input) is a SWD Write Operation.
  * \param *swdctx swd context to work on.
  * \param *cmd point to the actual command being sent.
@@ -50,132 +107,125 @@ extern struct jtag_interface *jtag_interface;
  * \bits tells how many bits to send (at most 8).
  * \bits nLSBfirst tells the shift direction: 0 = LSB first, other MSB first.
  * \return data count transferred, or negative SWD_ERROR code on failure.
-ar)*/
+ */
 int swd_drv_mosi_8(swd_ctx_t *swdctx, swd_cmd_t *cmd, char *data, int bits, int nLSBfirst){
- LOG_DEBUG("OpenOCD's swd_drv_mosi_8(swdctx=@%p, cmd=@%p, data=0x%02X, bits=%d, nLSBfirst=0x%02X)", (void*)swdctx, (void*)cmd, *data, bits, nLSBfirst);
  if (data==NULL) return SWD_ERROR_NULLPOINTER;
- if (bits<0 && bits>8) return SWD_ERROR_PARAM;
+ if (bits<0 || bits>8) return SWD_ERROR_PARAM;
  if (nLSBfirst!=0 && nLSBfirst!=1) return SWD_ERROR_PARAM;
+ DEBUG_SWD_IO("mosi_8 data=0x%02X bits=%d nLSBfirst=%d", (uint8_t)*data, bits, nLSBfirst);
+
+ int res;
+ uint8_t mosi=*data;
 
- static unsigned int i;
- static signed int res;
- static char misodata[8], mosidata[8];
+ /* Idle cycles go ahead of the request, after the previous transfer. */
+ if (cmd && cmd->cmdtype==SWD_CMDTYPE_MOSI_REQUEST){
+  res=swd_drv_idle(swdctx, interface);
+  if (res<0) return SWD_ERROR_DRIVER;
+ }
 
- /* Split output data into char array. */
- for (i=0;i<8;i++) mosidata[(nLSBfirst==SWD_DIR_LSBFIRST)?(i):(bits-1-i)]=((1<<i)&(*data))?1:0; 
- /* Then send that array into interface hardware. */
- res=jtag_interface->transfer(NULL, bits, mosidata, misodata, 0);
+ /* Send packed data into interface hardware, nothing to capture here. */
+ res=oocd_interface_transfer_bits(swd_drv_interface(swdctx), NULL, bits, &mosi, NULL, 0, nLSBfirst);
  if (res<0) return SWD_ERROR_DRIVER;
 
- return i;
+ return res;
 }
 
 /**
- * Use UrJTAG's driver to write 32-bit data (int type).
+ * Use OpenOCD's driver to write 32-bit data (int type).
  * MOSI (Master Output Slave Input) is a SWD Write Operation.
  * \param *swdctx swd context to work on.
  * \param *cmd point to the actual command being sent.
- * \param *data points to the char buffer array.
+ * \param *data points to the int data.
  * \bits tells how many bits to send (at most 32).
  * \bits nLSBfirst tells the shift direction: 0 = LSB first, other MSB first.
  * \return data count transferred, or negative SWD_ERROR code on failure.
  */
 int swd_drv_mosi_32(swd_ctx_t *swdctx, swd_cmd_t *cmd, int *data, int bits, int nLSBfirst){
- LOG_DEBUG("OpenOCD's swd_drv_mosi_32(swdctx=@%p, cmd=@%p, data=0x%08X, bits=%d, nLSBfirst=0x%02X)", (void*)swdctx, (void*)cmd, *data, bits, nLSBfirst);
  if (data==NULL) return SWD_ERROR_NULLPOINTER;
- if (bits<0 && bits>8) return SWD_ERROR_PARAM;
+ if (bits<0 || bits>32) return SWD_ERROR_PARAM;
  if (nLSBfirst!=0 && nLSBfirst!=1) return SWD_ERROR_PARAM;
+ DEBUG_SWD_IO("mosi_32 data=0x%08X bits=%d nLSBfirst=%d", *data, bits, nLSBfirst);
 
- static unsigned int i;
- static signed int res;
- static char misodata[32], mosidata[32];
+ int res;
+ uint8_t mosi[4];
 
- //UrJTAG drivers shift data LSB-First.
- for (i=0;i<32;i++) mosidata[(nLSBfirst==SWD_DIR_LSBFIRST)?(i):(bits-1-i)]=((1<<i)&(*data))?1:0; 
- res=jtag_interface->transfer(NULL, bits, mosidata, misodata, 0);
+ h_u32_to_le(mosi, *data);
+ res=oocd_interface_transfer_bits(swd_drv_interface(swdctx), NULL, bits, mosi, NULL, 0, nLSBfirst);
  if (res<0) return SWD_ERROR_DRIVER;
- return i;
+ return res;
 }
 
 /**
- * Use UrJTAG's driver to read 8-bit data (char type).
+ * Use OpenOCD's driver to read 8-bit data (char type).
  * MISO (Master Input Slave Output) is a SWD Read Operation.
  * \param *swdctx swd context to work on.
  * \param *cmd point to the actual command being sent.
- * \param *data points to the char buffer array.
- * \bits tells how many bits to send (at most 8).
+ * \param *data points to the char buffer.
+ * \bits tells how many bits to read (at most 8).
  * \bits nLSBfirst tells the shift direction: 0 = LSB first, other MSB first.
  * \return data count transferred, or negative SWD_ERROR code on failure.
  */
 int swd_drv_miso_8(swd_ctx_t *swdctx, swd_cmd_t *cmd, char *data, int bits, int nLSBfirst){
  if (data==NULL) return SWD_ERROR_NULLPOINTER;
- if (bits<0 && bits>8) return SWD_ERROR_PARAM;
+ if (bits<0 || bits>8) return SWD_ERROR_PARAM;
  if (nLSBfirst!=0 && nLSBfirst!=1) return SWD_ERROR_PARAM;
 
- static int i;
- static signed int res;
- static char misodata[8], mosidata[8];
+ int res;
+ uint8_t miso=0;
 
- res=jtag_interface->transfer(NULL, bits, mosidata, misodata, SWD_DIR_LSBFIRST);
+ res=oocd_interface_transfer_bits(swd_drv_interface(swdctx), NULL, bits, NULL, &miso, 0, nLSBfirst);
  if (res<0) return SWD_ERROR_DRIVER;
- /* Now we need to reconstruct the data byte from shifted in LSBfirst byte array. */
- *data=0;
- for (i=0;i<bits;i++) *data|=misodata[(nLSBfirst==SWD_DIR_LSBFIRST)?(i):(bits-1-i)]?(1<<i):0;
- LOG_DEBUG("OpenOCD's swd_drv_miso_8(swdctx=@%p, cmd=@%p, data=@%p, bits=%d, nLSBfirst=0x%02X) reads: 0x%02X", (void*)swdctx, (void*)cmd, (void*)data, bits, nLSBfirst, *data);
- return i;
+ *data=miso;
+ DEBUG_SWD_IO("miso_8 data=0x%02X bits=%d nLSBfirst=%d", miso, bits, nLSBfirst);
+ return res;
 }
 
 /**
- * Use UrJTAG's driver to read 32-bit data (int type).
+ * Use OpenOCD's driver to read 32-bit data (int type).
  * MISO (Master Input Slave Output) is a SWD Read Operation.
  * \param *swdctx swd context to work on.
  * \param *cmd point to the actual command being sent.
- * \param *data points to the char buffer array.
- * \bits tells how many bits to send (at most 32).
+ * \param *data points to the int buffer.
+ * \bits tells how many bits to read (at most 32).
  * \bits nLSBfirst tells the shift direction: 0 = LSB first, other MSB first.
  * \return data count transferred, or negative SWD_ERROR code on failure.
  */
 int swd_drv_miso_32(swd_ctx_t *swdctx, swd_cmd_t *cmd, int *data, int bits, int nLSBfirst){
  if (data==NULL) return SWD_ERROR_NULLPOINTER;
- if (bits<0 && bits>8) return SWD_ERROR_PARAM;
+ if (bits<0 || bits>32) return SWD_ERROR_PARAM;
  if (nLSBfirst!=0 && nLSBfirst!=1) return SWD_ERROR_PARAM;
 
- static int i;
- static signed int res;
- static char misodata[32], mosidata[32];
+ int res;
+ uint8_t miso[4]={0, 0, 0, 0};
 
- res=jtag_interface->transfer(NULL, bits, mosidata, misodata, SWD_DIR_LSBFIRST);
+ res=oocd_interface_transfer_bits(swd_drv_interface(swdctx), NULL, bits, NULL, miso, 0, nLSBfirst);
  if (res<0) return SWD_ERROR_DRIVER;
- /* Now we need to reconstruct the data byte from shifted in LSBfirst byte array. */
- *data=0;
- for (i=0;i<bits;i++) *data|=(misodata[(nLSBfirst==SWD_DIR_LSBFIRST)?(i):(bits-1-i)]?(1<<i):0);
- LOG_DEBUG("OpenOCD's swd_drv_miso_32(swdctx=@%p, cmd=@%p, data=@%p, bits=%d, nLSBfirst=0x%02X) reads: 0x%08X", (void*)swdctx, (void*)cmd, (void*)data, bits, nLSBfirst, *data);
- LOG_DEBUG("OpenOCD's swd_drv_miso_32() reads: 0x%08X\n", *data);
- return i;
-}       
+ *data=le_to_h_u32(miso);
+ DEBUG_SWD_IO("miso_32 data=0x%08X bits=%d nLSBfirst=%d", *data, bits, nLSBfirst);
+ return res;
+}
 
 /**
  * This function sets interface buffers to MOSI direction.
  * MOSI (Master Output Slave Input) is a SWD Write operation.
- * OpenOCD use global "struct jtag_interface" pointer as interface driver.
  * OpenOCD driver must support "RnW" signal to drive output buffers for TRN.
  * \param *swdctx is the swd context to work on.
  * \param bits specify how many clock cycles must be used for TRN.
  * \return number of bits transmitted or negative SWD_ERROR code on failure. 
  */
 int swd_drv_mosi_trn(swd_ctx_t *swdctx, int bits){
- LOG_DEBUG("OpenOCD's swd_drv_mosi_trn(swdctx=@%p, bits=%d)\n", (void*)swdctx, bits);
- if (bits<SWD_TURNROUND_MIN_VAL && bits>SWD_TURNROUND_MAX_VAL)
+ if (bits<SWD_TURNROUND_MIN_VAL || bits>SWD_TURNROUND_MAX_VAL)
   return SWD_ERROR_TURNAROUND; 
+ DEBUG_SWD_IO("mosi_trn bits=%d", bits);
 
+ struct jtag_interface *interface=swd_drv_interface(swdctx);
  int res, val=0;
- static char buf[SWD_TURNROUND_MAX_VAL];
  /* Use driver method to set low (write) signal named RnW. */
- res=jtag_interface->bitbang(NULL, "RnW", 0, &val);
+ res=interface->bitbang(NULL, "RnW", 0, &val);
  if (res<0) return SWD_ERROR_DRIVER;
 
  /* Clock specified number of bits for proper TRN transaction. */
- res=jtag_interface->transfer(NULL, bits, buf, buf, 0); 
+ res=oocd_interface_transfer_bits(interface, NULL, bits, NULL, NULL, 0, 0);
  if (res<0) return SWD_ERROR_DRIVER;
 
  return bits;
@@ -184,26 +234,25 @@ int swd_drv_mosi_trn(swd_ctx_t *swdctx, int bits){
 /**
  * This function sets interface buffers to MISO direction.
  * MISO (Master Input Slave Output) is a SWD Read operation.
- * OpenOCD use global "struct jtag_interface" pointer as interface driver.
  * OpenOCD driver must support "RnW" signal to drive output buffers for TRN.
  * \param *swdctx is the swd context to work on.
  * \param bits specify how many clock cycles must be used for TRN.
  * \return number of bits transmitted or negative SWD_ERROR code on failure. 
  */
 int swd_drv_miso_trn(swd_ctx_t *swdctx, int bits){
- LOG_DEBUG("OpenOCD's swd_drv_miso_trn(swdctx=@%p, bits=%d)\n", (void*)swdctx, bits);
- if (bits<SWD_TURNROUND_MIN_VAL && bits>SWD_TURNROUND_MAX_VAL)
+ if (bits<SWD_TURNROUND_MIN_VAL || bits>SWD_TURNROUND_MAX_VAL)
   return SWD_ERROR_TURNAROUND; 
+ DEBUG_SWD_IO("miso_trn bits=%d", bits);
 
- static int res, val=1;
- static char buf[SWD_TURNROUND_MAX_VAL];
+ struct jtag_interface *interface=swd_drv_interface(swdctx);
+ int res, val=1;
 
  /* Use driver method to set high (read) signal named RnW. */
- res=jtag_interface->bitbang(NULL, "RnW", 0xFFFFFFFF, &val);
+ res=interface->bitbang(NULL, "RnW", 0xFFFFFFFF, &val);
  if (res<0) return SWD_ERROR_DRIVER;
 
  /* Clock specified number of bits for proper TRN transaction. */
- res=jtag_interface->transfer(NULL, bits, buf, buf, 0); 
+ res=oocd_interface_transfer_bits(interface, NULL, bits, NULL, NULL, 0, 0);
  if (res<0) return SWD_ERROR_DRIVER;
  
  return bits;
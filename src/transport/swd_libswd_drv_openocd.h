@@ -36,8 +36,31 @@
 
 /** \file libswd_drv_openocd.h Driver Bridge between LibSWD and OpenOCD header file. */
 
+#ifndef OOCD_SWD_LIBSWD_DRV_OPENOCD_H
+#define OOCD_SWD_LIBSWD_DRV_OPENOCD_H
+
 #include <libswd.h>
 
+struct jtag_interface;
+
+/** Most idle clocks the bridge will send ahead of a request. */
+#define SWD_DRV_IDLE_CYCLES_MAX 255
+
+/**
+ * Per-context state of the driver bridge, stored at swd_ctx_t driver->device.
+ * Everything the bridge needs is kept here or on the stack, so contexts
+ * working with different interfaces do not share any data.
+ */
+struct swd_drv_openocd {
+	/** Interface driver this context talks to. */
+	struct jtag_interface *interface;
+	/** Idle clocks sent ahead of each request, see swd_drv_idle_cycles(). */
+	int idle_cycles;
+};
+
+int swd_drv_init(swd_ctx_t *swdctx, struct jtag_interface *interface);
+int swd_drv_idle_cycles(swd_ctx_t *swdctx, int cycles);
+
 int swd_drv_mosi_8(swd_ctx_t *swdctx, swd_cmd_t *cmd, char *data, int bits, int nLSBfirst);
 int swd_drv_mosi_32(swd_ctx_t *swdctx, swd_cmd_t *cmd, int *data, int bits, int nLSBfirst);
 int swd_drv_miso_8(swd_ctx_t *swdctx, swd_cmd_t *cmd, char *data, int bits, int nLSBfirst);
@@ -47,3 +70,4 @@ int swd_drv_miso_trn(swd_ctx_t *swdctx, int bits);
 int swd_log_level_inherit(swd_ctx_t *swdctx, int loglevel);
 int swd_log(swd_ctx_t *swdctx, swd_loglevel_t loglevel, char *msg, ...);
 
+#endif
@@ -206,6 +206,19 @@ struct transport *get_current_transport(void)
 	return session_transport;
 }
 
+/**
+ * Releases resources of the transport used by this session, if any.
+ * Called once on exit.
+ *
+ * @returns ERROR_OK on success, else a fault code.
+ */
+int transport_quit(void)
+{
+	if (!session_transport || !session_transport->quit)
+		return ERROR_OK;
+	return session_transport->quit();
+}
+
 
 /*-----------------------------------------------------------------------*/
 
@@ -85,6 +85,13 @@ struct transport {
 	 */
 	int (*init)(struct command_context *ctx);
 
+	/**
+	 * Optional, releases whatever the transport allocated during the
+	 * session.  Called once on exit, after the server loop and targets
+	 * are done with the transport.
+	 */
+	int (*quit)(void);
+
 	/**
 	 * Transports are stored in a singly linked list.
 	 */
@@ -97,6 +104,8 @@ int transport_register(struct transport *new_transport);
 
 struct transport *get_current_transport(void);
 
+int transport_quit(void);
+
 int transport_register_commands(struct command_context *ctx);
 
 COMMAND_HELPER(transport_list_parse, char ***vector);
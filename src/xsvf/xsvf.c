@@ -44,6 +44,11 @@
 #include <jtag/jtag.h>
 #include <svf/svf.h>
 
+#include <sys/stat.h>
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
 
 /* XSVF commands, from appendix B of xapp503.pdf  */
 #define XCOMPLETE		0x00
@@ -124,7 +129,40 @@ LSDR 1  TDI  (0)
 #define XSTATE_MAX_PATH 12
 
 
-static int xsvf_fd = 0;
+/* The whole XSVF file is mapped (or, lacking mmap(), read) into memory
+ * once and every opcode and argument is decoded straight from it.
+ * xsvf_pos is the offset of the next unread byte.
+ */
+static const uint8_t *xsvf_data;
+static size_t xsvf_len;
+static size_t xsvf_pos;
+static bool xsvf_mapped;
+
+/* Deferred XSDR/XSDRTDO checking.  When XREPEAT is zero there is nothing
+ * to retry, so a scan's TDO result only decides pass/fail: scans are then
+ * queued back to back, their expected value and mask copied into the
+ * batch buffer, and compared by a queue callback when the batch is
+ * flushed.  Ops which wait on the queue themselves flush the batch first.
+ */
+#define XSVF_BATCH_BYTES	(256 * 1024)
+#define XSVF_BATCH_SCANS	1024
+
+struct xsvf_batch;
+
+/* what the queue callback needs to know about one deferred scan */
+struct xsvf_batch_check {
+	struct xsvf_batch *batch;
+	long offset;		/* file offset of the scan's XSDR/XSDRTDO */
+	int num_bits;
+};
+
+struct xsvf_batch {
+	uint8_t *buf;		/* captured TDO, expected TDO and mask, per scan */
+	struct xsvf_batch_check *checks;	/* one per queued scan */
+	size_t used;
+	unsigned scans;
+	long offset;		/* file offset of the scan a failed flush stopped at */
+};
 
 
 /* map xsvf tap state to an openocd "tap_state_t" */
@@ -160,17 +198,216 @@ static tap_state_t xsvf_to_tap(int xsvf_state)
 
 
 
-static int xsvf_read_buffer(int num_bits, int fd, uint8_t* buf)
+static int xsvf_open(const char *filename)
+{
+	struct stat st;
+	int fd;
+
+	fd = open(filename, O_RDONLY | O_BINARY);
+	if (fd < 0)
+		return ERROR_FAIL;
+
+	if (fstat(fd, &st) != 0)
+	{
+		close(fd);
+		return ERROR_FAIL;
+	}
+
+	xsvf_data = NULL;
+	xsvf_len = st.st_size;
+	xsvf_pos = 0;
+	xsvf_mapped = false;
+
+	if (xsvf_len == 0)
+	{
+		close(fd);
+		return ERROR_OK;
+	}
+
+#ifdef HAVE_SYS_MMAN_H
+	void *map = mmap(NULL, xsvf_len, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map != MAP_FAILED)
+	{
+		xsvf_data = map;
+		xsvf_mapped = true;
+		close(fd);
+		return ERROR_OK;
+	}
+#endif
+
+	uint8_t *data = malloc(xsvf_len);
+	size_t done = 0;
+
+	while (data && done < xsvf_len)
+	{
+		ssize_t n = read(fd, data + done, xsvf_len - done);
+		if (n <= 0)
+			break;
+		done += n;
+	}
+	close(fd);
+
+	if (!data || done < xsvf_len)
+	{
+		free(data);
+		return ERROR_FAIL;
+	}
+
+	xsvf_data = data;
+	return ERROR_OK;
+}
+
+static void xsvf_close(void)
+{
+#ifdef HAVE_SYS_MMAN_H
+	if (xsvf_mapped)
+		munmap((void *)xsvf_data, xsvf_len);
+	else
+#endif
+		free((void *)xsvf_data);
+
+	xsvf_data = NULL;
+	xsvf_len = 0;
+	xsvf_pos = 0;
+	xsvf_mapped = false;
+}
+
+static int xsvf_read(void *buf, size_t count)
+{
+	if (xsvf_len - xsvf_pos < count)
+		return ERROR_XSVF_EOF;
+
+	memcpy(buf, xsvf_data + xsvf_pos, count);
+	xsvf_pos += count;
+
+	return ERROR_OK;
+}
+
+static int xsvf_read_buffer(int num_bits, uint8_t* buf)
+{
+	size_t num_bytes = (num_bits + 7) / 8;
+	const uint8_t *src;
+
+	if (xsvf_len - xsvf_pos < num_bytes)
+		return ERROR_XSVF_EOF;
+
+	/* reverse the order of bytes as they are stored sequentially in the file */
+	src = xsvf_data + xsvf_pos;
+	while (num_bytes > 0)
+		buf[--num_bytes] = *src++;
+	xsvf_pos = src - xsvf_data;
+
+	return ERROR_OK;
+}
+
+static int xsvf_check_callback(jtag_callback_data_t data0, jtag_callback_data_t data1,
+		jtag_callback_data_t data2, jtag_callback_data_t data3)
+{
+	const uint8_t *captured = (const uint8_t *)data0;
+	const uint8_t *expected = (const uint8_t *)data1;
+	const uint8_t *mask = (const uint8_t *)data2;
+	struct xsvf_batch_check *check = (struct xsvf_batch_check *)data3;
+
+	if (buf_cmp_mask(captured, expected, mask, check->num_bits))
+	{
+		/* keep the first one, later scans may just echo it */
+		if (check->batch->offset < 0)
+			check->batch->offset = check->offset;
+		return ERROR_JTAG_QUEUE_FAILED;
+	}
+
+	return ERROR_OK;
+}
+
+/* does this op wait on the JTAG queue (so deferred scans must settle first)? */
+static bool xsvf_op_waits(uint8_t opcode, int xrepeat)
+{
+	switch (opcode)
+	{
+	case XSDR:
+	case XSDRTDO:
+		return xrepeat > 0;
+	case XCOMPLETE:
+	case XSIR:
+	case XSIR2:
+	case XSTATE:
+	case LSDR:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static int xsvf_batch_flush(struct xsvf_batch *batch)
+{
+	int retval;
+
+	/* set by the check callback of the scan that mismatched */
+	batch->offset = -1;
+
+	retval = jtag_execute_queue();
+	if (retval != ERROR_OK)
+	{
+		LOG_USER("XSDR mismatch in a batch of %u deferred scans", batch->scans);
+
+		/* any other queue failure is blamed on the first scan */
+		if (batch->offset < 0)
+			batch->offset = batch->checks[0].offset;
+	}
+
+	batch->used = 0;
+	batch->scans = 0;
+
+	return retval;
+}
+
+/* queue one XSDR/XSDRTDO scan whose TDO is checked when the batch is flushed */
+static int xsvf_batch_scan(struct xsvf_batch *batch, struct jtag_tap *tap,
+		int num_bits, const uint8_t *out, const uint8_t *expected,
+		const uint8_t *mask, long offset)
 {
-	int num_bytes;
+	size_t num_bytes = DIV_ROUND_UP(num_bits, 8);
+	struct xsvf_batch_check *check;
+	struct scan_field field;
+	uint8_t *slot;
 
-	for (num_bytes = (num_bits + 7) / 8; num_bytes > 0; num_bytes--)
+	if (batch->used + 3 * num_bytes > XSVF_BATCH_BYTES
+			|| batch->scans == XSVF_BATCH_SCANS)
 	{
-		/* reverse the order of bytes as they are read sequentially from file */
-		if (read(fd, buf + num_bytes - 1, 1) < 0)
-			return ERROR_XSVF_EOF;
+		int retval = xsvf_batch_flush(batch);
+		if (retval != ERROR_OK)
+			return retval;
 	}
 
+	check = batch->checks + batch->scans;
+	check->batch = batch;
+	check->offset = offset;
+	check->num_bits = num_bits;
+
+	slot = batch->buf + batch->used;
+	memset(slot, 0, num_bytes);
+	memcpy(slot + num_bytes, expected, num_bytes);
+	memcpy(slot + 2 * num_bytes, mask, num_bytes);
+
+	field.num_bits = num_bits;
+	field.out_value = out;
+	field.in_value = slot;
+
+	if (tap == NULL)
+		jtag_add_plain_dr_scan(field.num_bits, field.out_value, field.in_value,
+				TAP_DRPAUSE);
+	else
+		jtag_add_dr_scan(tap, 1, &field, TAP_DRPAUSE);
+
+	jtag_add_callback4(xsvf_check_callback,
+			(jtag_callback_data_t)slot,
+			(jtag_callback_data_t)(slot + num_bytes),
+			(jtag_callback_data_t)(slot + 2 * num_bytes),
+			(jtag_callback_data_t)check);
+
+	batch->used += 3 * num_bytes;
+	batch->scans++;
+
 	return ERROR_OK;
 }
 
@@ -207,6 +444,8 @@ COMMAND_HANDLER(handle_xsvf_command)
 	tap_state_t	path[XSTATE_MAX_PATH];
 	unsigned	pathlen = 0;
 
+	struct xsvf_batch batch = { .buf = NULL };
+
 	/* a flag telling whether to clock TCK during waits,
 	 * or simply sleep, controled by virt2
 	 */
@@ -238,12 +477,22 @@ COMMAND_HANDLER(handle_xsvf_command)
 		}
 	}
 
-	if ((xsvf_fd = open(filename, O_RDONLY)) < 0)
+	if (xsvf_open(filename) != ERROR_OK)
 	{
 		command_print(CMD_CTX, "file \"%s\" not found", filename);
 		return ERROR_FAIL;
 	}
 
+	batch.buf = malloc(XSVF_BATCH_BYTES);
+	batch.checks = malloc(XSVF_BATCH_SCANS * sizeof(*batch.checks));
+	if (!batch.buf || !batch.checks)
+	{
+		free(batch.buf);
+		free(batch.checks);
+		xsvf_close();
+		return ERROR_FAIL;
+	}
+
 	/* if this argument is present, then interpret xruntest counts as TCK cycles rather than as usecs */
 	if ((CMD_ARGC > 2) && (strcmp(CMD_ARGV[2], "virt2") == 0))
 	{
@@ -259,10 +508,21 @@ COMMAND_HANDLER(handle_xsvf_command)
 
 	LOG_USER("xsvf processing file: \"%s\"", filename);
 
-	while (read(xsvf_fd, &opcode, 1) > 0)
+	while (xsvf_read(&opcode, 1) == ERROR_OK)
 	{
 		/* record the position of this opcode within the file */
-		file_offset = lseek(xsvf_fd, 0, SEEK_CUR) - 1;
+		file_offset = xsvf_pos - 1;
+
+		/* settle deferred scans before an op that waits on the queue,
+		 * so a mismatch is reported against the scans that caused it
+		 */
+		if (batch.scans && xsvf_op_waits(opcode, xrepeat)
+				&& xsvf_batch_flush(&batch) != ERROR_OK)
+		{
+			file_offset = batch.offset;
+			tdo_mismatch = 1;
+			break;
+		}
 
 		/* maybe collect another state for a pathmove();
 		 * or terminate a path.
@@ -282,7 +542,7 @@ COMMAND_HANDLER(handle_xsvf_command)
 					break;
 				}
 
-				if (read(xsvf_fd, &uc, 1) < 0)
+				if (xsvf_read(&uc, 1) != ERROR_OK)
 				{
 					do_abort = 1;
 					break;
@@ -357,7 +617,7 @@ COMMAND_HANDLER(handle_xsvf_command)
 
 		case XTDOMASK:
 			LOG_DEBUG("XTDOMASK");
-			if (dr_in_mask && (xsvf_read_buffer(xsdrsize, xsvf_fd, dr_in_mask) != ERROR_OK))
+			if (dr_in_mask && (xsvf_read_buffer(xsdrsize, dr_in_mask) != ERROR_OK))
 				do_abort = 1;
 			break;
 
@@ -365,7 +625,7 @@ COMMAND_HANDLER(handle_xsvf_command)
 			{
 				uint8_t	xruntest_buf[4];
 
-				if (read(xsvf_fd, xruntest_buf, 4) < 0)
+				if (xsvf_read(xruntest_buf, 4) != ERROR_OK)
 				{
 					do_abort = 1;
 					break;
@@ -380,7 +640,7 @@ COMMAND_HANDLER(handle_xsvf_command)
 			{
 				uint8_t myrepeat;
 
-				if (read(xsvf_fd, &myrepeat, 1) < 0)
+				if (xsvf_read(&myrepeat, 1) != ERROR_OK)
 					do_abort = 1;
 				else
 				{
@@ -394,7 +654,7 @@ COMMAND_HANDLER(handle_xsvf_command)
 			{
 				uint8_t	xsdrsize_buf[4];
 
-				if (read(xsvf_fd, xsdrsize_buf, 4) < 0)
+				if (xsvf_read(xsdrsize_buf, 4) != ERROR_OK)
 				{
 					do_abort = 1;
 					break;
@@ -422,7 +682,7 @@ COMMAND_HANDLER(handle_xsvf_command)
 
 				const char* op_name = (opcode == XSDR ? "XSDR" : "XSDRTDO");
 
-				if (xsvf_read_buffer(xsdrsize, xsvf_fd, dr_out_buf) != ERROR_OK)
+				if (xsvf_read_buffer(xsdrsize, dr_out_buf) != ERROR_OK)
 				{
 					do_abort = 1;
 					break;
@@ -430,7 +690,7 @@ COMMAND_HANDLER(handle_xsvf_command)
 
 				if (opcode == XSDRTDO)
 				{
-					if (xsvf_read_buffer(xsdrsize, xsvf_fd, dr_in_buf)  != ERROR_OK)
+					if (xsvf_read_buffer(xsdrsize, dr_in_buf)  != ERROR_OK)
 					{
 						do_abort = 1;
 						break;
@@ -442,6 +702,21 @@ COMMAND_HANDLER(handle_xsvf_command)
 
 				LOG_DEBUG("%s %d", op_name, xsdrsize);
 
+				/* nothing to retry:  queue it, check it later */
+				if (xrepeat == 0 && 3 * DIV_ROUND_UP(xsdrsize, 8) <= XSVF_BATCH_BYTES)
+				{
+					result = xsvf_batch_scan(&batch, tap, xsdrsize,
+							dr_out_buf, dr_in_buf, dr_in_mask, file_offset);
+					if (result != ERROR_OK)
+					{
+						file_offset = batch.offset;
+						tdo_mismatch = 1;
+						break;
+					}
+					matched = 1;
+					limit = 0;
+				}
+
 				for (attempt = 0; attempt < limit;  ++attempt)
 				{
 					struct scan_field field;
@@ -565,7 +840,7 @@ COMMAND_HANDLER(handle_xsvf_command)
 			{
 				tap_state_t	mystate;
 
-				if (read(xsvf_fd, &uc, 1) < 0)
+				if (xsvf_read(&uc, 1) != ERROR_OK)
 				{
 					do_abort = 1;
 					break;
@@ -610,7 +885,7 @@ COMMAND_HANDLER(handle_xsvf_command)
 
 		case XENDIR:
 
-			if (read(xsvf_fd, &uc, 1) < 0)
+			if (xsvf_read(&uc, 1) != ERROR_OK)
 			{
 				do_abort = 1;
 				break;
@@ -633,7 +908,7 @@ COMMAND_HANDLER(handle_xsvf_command)
 
 		case XENDDR:
 
-			if (read(xsvf_fd, &uc, 1) < 0)
+			if (xsvf_read(&uc, 1) != ERROR_OK)
 			{
 				do_abort = 1;
 				break;
@@ -665,7 +940,7 @@ COMMAND_HANDLER(handle_xsvf_command)
 				if (opcode == XSIR)
 				{
 					/* one byte bitcount */
-					if (read(xsvf_fd, short_buf, 1) < 0)
+					if (xsvf_read(short_buf, 1) != ERROR_OK)
 					{
 						do_abort = 1;
 						break;
@@ -675,7 +950,7 @@ COMMAND_HANDLER(handle_xsvf_command)
 				}
 				else
 				{
-					if (read(xsvf_fd, short_buf, 2) < 0)
+					if (xsvf_read(short_buf, 2) != ERROR_OK)
 					{
 						do_abort = 1;
 						break;
@@ -686,7 +961,7 @@ COMMAND_HANDLER(handle_xsvf_command)
 
 				ir_buf = malloc((bitcount + 7) / 8);
 
-				if (xsvf_read_buffer(bitcount, xsvf_fd, ir_buf) != ERROR_OK)
+				if (xsvf_read_buffer(bitcount, ir_buf) != ERROR_OK)
 					do_abort = 1;
 				else
 				{
@@ -737,7 +1012,7 @@ COMMAND_HANDLER(handle_xsvf_command)
 
 				do
 				{
-					if (read(xsvf_fd, &uc, 1) < 0)
+					if (xsvf_read(&uc, 1) != ERROR_OK)
 					{
 						do_abort = 1;
 						break;
@@ -768,9 +1043,9 @@ COMMAND_HANDLER(handle_xsvf_command)
 				tap_state_t end_state;
 				int	delay;
 
-				if (read(xsvf_fd, &wait_local, 1) < 0
-				  || read(xsvf_fd, &end, 1) < 0
-				  || read(xsvf_fd, delay_buf, 4) < 0)
+				if (xsvf_read(&wait_local, 1) != ERROR_OK
+				  || xsvf_read(&end, 1) != ERROR_OK
+				  || xsvf_read(delay_buf, 4) != ERROR_OK)
 				{
 					do_abort = 1;
 					break;
@@ -811,10 +1086,10 @@ COMMAND_HANDLER(handle_xsvf_command)
 				int clock_count;
 				int usecs;
 
-				if (read(xsvf_fd, &wait_local, 1) < 0
-				 ||  read(xsvf_fd, &end, 1) < 0
-				 ||  read(xsvf_fd, clock_buf, 4) < 0
-				 ||  read(xsvf_fd, usecs_buf, 4) < 0)
+				if (xsvf_read(&wait_local, 1) != ERROR_OK
+				 ||  xsvf_read(&end, 1) != ERROR_OK
+				 ||  xsvf_read(clock_buf, 4) != ERROR_OK
+				 ||  xsvf_read(usecs_buf, 4) != ERROR_OK)
 				{
 					do_abort = 1;
 					break;
@@ -862,7 +1137,7 @@ COMMAND_HANDLER(handle_xsvf_command)
 				*/
 				uint8_t  count_buf[4];
 
-				if (read(xsvf_fd, count_buf, 4) < 0)
+				if (xsvf_read(count_buf, 4) != ERROR_OK)
 				{
 					do_abort = 1;
 					break;
@@ -882,9 +1157,9 @@ COMMAND_HANDLER(handle_xsvf_command)
 				uint8_t  clock_buf[4];
 				uint8_t  usecs_buf[4];
 
-				if (read(xsvf_fd, &state, 1) < 0
-				  || read(xsvf_fd, clock_buf, 4) < 0
-				  ||	 read(xsvf_fd, usecs_buf, 4) < 0)
+				if (xsvf_read(&state, 1) != ERROR_OK
+				  || xsvf_read(clock_buf, 4) != ERROR_OK
+				  ||	 xsvf_read(usecs_buf, 4) != ERROR_OK)
 				{
 					do_abort = 1;
 					break;
@@ -910,8 +1185,8 @@ COMMAND_HANDLER(handle_xsvf_command)
 
 				LOG_DEBUG("LSDR");
 
-				if (xsvf_read_buffer(xsdrsize, xsvf_fd, dr_out_buf) != ERROR_OK
-				  || xsvf_read_buffer(xsdrsize, xsvf_fd, dr_in_buf) != ERROR_OK)
+				if (xsvf_read_buffer(xsdrsize, dr_out_buf) != ERROR_OK
+				  || xsvf_read_buffer(xsdrsize, dr_in_buf) != ERROR_OK)
 				{
 					do_abort = 1;
 					break;
@@ -968,7 +1243,7 @@ COMMAND_HANDLER(handle_xsvf_command)
 			{
 				uint8_t	trst_mode;
 
-				if (read(xsvf_fd, &trst_mode, 1) < 0)
+				if (xsvf_read(&trst_mode, 1) != ERROR_OK)
 				{
 					do_abort = 1;
 					break;
@@ -998,16 +1273,34 @@ COMMAND_HANDLER(handle_xsvf_command)
 		}
 
 		if (do_abort || unsupported || tdo_mismatch)
-		{
-			LOG_DEBUG("xsvf failed, setting taps to reasonable state");
-
-			/* upon error, return the TAPs to a reasonable state */
-			result = svf_add_statemove(TAP_IDLE);
-			result = jtag_execute_queue();
 			break;
-		}
 	}
 
+	/* a file without XCOMPLETE may still have deferred scans queued */
+	if (!(do_abort || unsupported || tdo_mismatch) && batch.scans
+			&& xsvf_batch_flush(&batch) != ERROR_OK)
+	{
+		file_offset = batch.offset;
+		tdo_mismatch = 1;
+	}
+
+	if (do_abort || unsupported || tdo_mismatch)
+	{
+		LOG_DEBUG("xsvf failed, setting taps to reasonable state");
+
+		/* upon error, return the TAPs to a reasonable state */
+		result = svf_add_statemove(TAP_IDLE);
+		result = jtag_execute_queue();
+	}
+
+	free(batch.buf);
+	free(batch.checks);
+	free(dr_out_buf);
+	free(dr_in_buf);
+	free(dr_in_mask);
+
+	xsvf_close();
+
 	if (tdo_mismatch)
 	{
 		command_print(CMD_CTX, "TDO mismatch, somewhere near offset %lu in xsvf file, aborting",
@@ -1019,10 +1312,9 @@ COMMAND_HANDLER(handle_xsvf_command)
 
 	if (unsupported)
 	{
-		off_t offset = lseek(xsvf_fd, 0, SEEK_CUR) - 1;
 		command_print(CMD_CTX,
-				"unsupported xsvf command (0x%02X) at offset %jd, aborting",
-				uc, (intmax_t)offset);
+				"unsupported xsvf command (0x%02X) at offset %ld, aborting",
+				uc, file_offset);
 		return ERROR_FAIL;
 	}
 
@@ -1032,17 +1324,6 @@ COMMAND_HANDLER(handle_xsvf_command)
 		return ERROR_FAIL;
 	}
 
-	if (dr_out_buf)
-		free(dr_out_buf);
-
-	if (dr_in_buf)
-		free(dr_in_buf);
-
-	if (dr_in_mask)
-		free(dr_in_mask);
-
-	close(xsvf_fd);
-
 	command_print(CMD_CTX, "XSVF file programmed successfully");
 
 	return ERROR_OK;